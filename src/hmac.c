@@ -29,99 +29,161 @@
 #include <stdio.h>
 #include "hmac.h"
 
-void hmac_makekey(struct hmac_context *ctx, const uint8_t *key, size_t keylen)
+// Hash long keys and pad the key with zeroes up to the block size
+static void hmac_makekey(const struct hmac_key *hkey, uint8_t *block, const uint8_t *key, size_t keylen)
 {
-    if(keylen > ctx->blocksize)
+    if(keylen > hkey->blocksize)
     {
         // Hash the long key
-        ctx->hash_init(&ctx->hashctx);
-        ctx->hash_update(&ctx->hashctx, key, keylen);
-        ctx->hash_final(&ctx->hashctx, ctx->key);
-        keylen = ctx->hashsize;
+        union hmac_hashctx hashctx;
+        hkey->hash_init(&hashctx);
+        hkey->hash_update(&hashctx, key, keylen);
+        hkey->hash_final(&hashctx, block);
+        keylen = hkey->hashsize;
     }
     else
     {
         // copy the short key
-        memcpy(ctx->key, key, keylen);
+        memcpy(block, key, keylen);
     }
     
     // Pad it with 0 until the blocksize
-    memset(ctx->key + keylen, 0, ctx->blocksize - keylen);
+    memset(block + keylen, 0, hkey->blocksize - keylen);
 }
 
-void hmac_xorkey(struct hmac_context *ctx, uint8_t xorbyte)
+static void hmac_xorkey(uint8_t *block, size_t blocksize, uint8_t xorbyte)
 {
-    for(size_t i = 0; i < ctx->blocksize; i++)
-        ctx->key[i] ^= xorbyte;
+    for(size_t i = 0; i < blocksize; i++)
+        block[i] ^= xorbyte;
 }
 
-void hmac_init(struct hmac_context *ctx, const uint8_t *key, size_t keylen, int hashtype)
+int hmac_key_init(struct hmac_key *hkey, const uint8_t *key, size_t keylen, int hashtype)
 {
+    uint8_t block[128];    // Make sure to upgrade this when introducing a hash algo with bigger blocksize
+
+    hkey->hashtype = hashtype;
     switch(hashtype)
     {
         case HMAC_MD2:
-            ctx->blocksize = 16;
-            ctx->hashsize  = 16;
-            ctx->hash_init   = (hashinit_t)md2_init;
-            ctx->hash_update = (hashupdate_t)md2_update;
-            ctx->hash_final  = (hashfinal_t)md2_final;
+            hkey->blocksize = 16;
+            hkey->hashsize  = 16;
+            hkey->hash_init   = (hashinit_t)md2_init;
+            hkey->hash_update = (hashupdate_t)md2_update;
+            hkey->hash_final  = (hashfinal_t)md2_final;
             break;
         case HMAC_MD5:
-            ctx->blocksize = 64;
-            ctx->hashsize  = 16;
-            ctx->hash_init   = (hashinit_t)&md5_init;
-            ctx->hash_update = (hashupdate_t)&md5_update;
-            ctx->hash_final  = (hashfinal_t)&md5_final;
+            hkey->blocksize = 64;
+            hkey->hashsize  = 16;
+            hkey->hash_init   = (hashinit_t)&md5_init;
+            hkey->hash_update = (hashupdate_t)&md5_update;
+            hkey->hash_final  = (hashfinal_t)&md5_final;
             break;
         case HMAC_SHA1:
-            ctx->blocksize = 64;
-            ctx->hashsize  = 20;
-            ctx->hash_init   = (hashinit_t)sha1_init;
-            ctx->hash_update = (hashupdate_t)sha1_update;
-            ctx->hash_final  = (hashfinal_t)sha1_final;
+            hkey->blocksize = 64;
+            hkey->hashsize  = 20;
+            hkey->hash_init   = (hashinit_t)sha1_init;
+            hkey->hash_update = (hashupdate_t)sha1_update;
+            hkey->hash_final  = (hashfinal_t)sha1_final;
             break;
         case HMAC_SHA2_224:
-            ctx->blocksize = 64;
-            ctx->hashsize  = 28;
-            ctx->hash_init   = (hashinit_t)sha2_224_init;
-            ctx->hash_update = (hashupdate_t)sha2_224_update;
-            ctx->hash_final  = (hashfinal_t)sha2_224_final;
+            hkey->blocksize = 64;
+            hkey->hashsize  = 28;
+            hkey->hash_init   = (hashinit_t)sha2_224_init;
+            hkey->hash_update = (hashupdate_t)sha2_224_update;
+            hkey->hash_final  = (hashfinal_t)sha2_224_final;
             break;
         case HMAC_SHA2_256:
-            ctx->blocksize = 64;
-            ctx->hashsize  = 32;
-            ctx->hash_init   = (hashinit_t)sha2_256_init;
-            ctx->hash_update = (hashupdate_t)sha2_256_update;
-            ctx->hash_final  = (hashfinal_t)sha2_256_final;
+            hkey->blocksize = 64;
+            hkey->hashsize  = 32;
+            hkey->hash_init   = (hashinit_t)sha2_256_init;
+            hkey->hash_update = (hashupdate_t)sha2_256_update;
+            hkey->hash_final  = (hashfinal_t)sha2_256_final;
             break;
         case HMAC_SHA2_384:
-            ctx->blocksize = 128;
-            ctx->hashsize  = 48;
-            ctx->hash_init   = (hashinit_t)sha2_384_init;
-            ctx->hash_update = (hashupdate_t)sha2_384_update;
-            ctx->hash_final  = (hashfinal_t)sha2_384_final;
+            hkey->blocksize = 128;
+            hkey->hashsize  = 48;
+            hkey->hash_init   = (hashinit_t)sha2_384_init;
+            hkey->hash_update = (hashupdate_t)sha2_384_update;
+            hkey->hash_final  = (hashfinal_t)sha2_384_final;
             break;
         case HMAC_SHA2_512:
-            ctx->blocksize = 128;
-            ctx->hashsize  = 64;
-            ctx->hash_init   = (hashinit_t)sha2_512_init;
-            ctx->hash_update = (hashupdate_t)sha2_512_update;
-            ctx->hash_final  = (hashfinal_t)sha2_512_final;
+            hkey->blocksize = 128;
+            hkey->hashsize  = 64;
+            hkey->hash_init   = (hashinit_t)sha2_512_init;
+            hkey->hash_update = (hashupdate_t)sha2_512_update;
+            hkey->hash_final  = (hashfinal_t)sha2_512_final;
+            break;
+        case HMAC_SHA2_512_224:
+            hkey->blocksize = 128;
+            hkey->hashsize  = 28;
+            hkey->hash_init   = (hashinit_t)sha2_512_224_init;
+            hkey->hash_update = (hashupdate_t)sha2_512_224_update;
+            hkey->hash_final  = (hashfinal_t)sha2_512_224_final;
+            break;
+        case HMAC_SHA2_512_256:
+            hkey->blocksize = 128;
+            hkey->hashsize  = 32;
+            hkey->hash_init   = (hashinit_t)sha2_512_256_init;
+            hkey->hash_update = (hashupdate_t)sha2_512_256_update;
+            hkey->hash_final  = (hashfinal_t)sha2_512_256_final;
+            break;
+        case HMAC_SKEIN_512:
+            hkey->blocksize = 64;
+            hkey->hashsize  = 64;
+            hkey->hash_init   = (hashinit_t)skein_512_init;
+            hkey->hash_update = (hashupdate_t)skein_512_update;
+            hkey->hash_final  = (hashfinal_t)skein_512_final;
+            break;
+        case HMAC_SKEIN_1024:
+            hkey->blocksize = 128;
+            hkey->hashsize  = 128;
+            hkey->hash_init   = (hashinit_t)skein_1024_init;
+            hkey->hash_update = (hashupdate_t)skein_1024_update;
+            hkey->hash_final  = (hashfinal_t)skein_1024_final;
             break;
+        default:
+            // Leave a key that can be told apart by its hashsize of 0
+            memset(hkey, 0, sizeof(*hkey));
+            hkey->hashtype = hashtype;
+            return -1;
     }
 
     // Prepare the key
-    hmac_makekey(ctx, key, keylen);
-    hmac_xorkey(ctx, HMAC_IPAD);
+    hmac_makekey(hkey, block, key, keylen);
+    hmac_xorkey(block, hkey->blocksize, HMAC_IPAD);
     
-    // prepare the hash function and feed the key into it
-    ctx->hash_init(&ctx->hashctx);
-    ctx->hash_update(&ctx->hashctx, ctx->key, ctx->blocksize);
+    // Feed the key into both hash states, the outer one gets key xor opad
+    hkey->hash_init(&hkey->inner);
+    hkey->hash_update(&hkey->inner, block, hkey->blocksize);
+    hmac_xorkey(block, hkey->blocksize, HMAC_IPAD ^ HMAC_OPAD);
+    hkey->hash_init(&hkey->outer);
+    hkey->hash_update(&hkey->outer, block, hkey->blocksize);
 
     // Clean up the key
-    hmac_xorkey(ctx, HMAC_IPAD);
+    memset(block, 0, sizeof(block));
+    return 0;
 }
 
+void hmac_init_key(struct hmac_context *ctx, const struct hmac_key *hkey)
+{
+    ctx->hashtype    = hkey->hashtype;
+    ctx->hashctx     = hkey->inner;
+    ctx->outer       = hkey->outer;
+    ctx->hash_init   = hkey->hash_init;
+    ctx->hash_update = hkey->hash_update;
+    ctx->hash_final  = hkey->hash_final;
+    ctx->hashsize    = hkey->hashsize;
+    ctx->blocksize   = hkey->blocksize;
+}
+
+int hmac_init(struct hmac_context *ctx, const uint8_t *key, size_t keylen, int hashtype)
+{
+    struct hmac_key hkey;
+    int ret = hmac_key_init(&hkey, key, keylen, hashtype);
+
+    hmac_init_key(ctx, &hkey);
+    return ret;
+}
 
 void hmac_update(struct hmac_context *ctx, const uint8_t *buffer, size_t len)
 {
@@ -134,19 +196,153 @@ void hmac_final(struct hmac_context *ctx, const uint8_t *mac)
     uint8_t intermediate[ctx->hashsize];
     ctx->hash_final(&ctx->hashctx, intermediate);
     
-    // create the outer hash
-    hmac_xorkey(ctx, HMAC_OPAD);
-    ctx->hash_init(&ctx->hashctx);
-    ctx->hash_update(&ctx->hashctx, ctx->key, ctx->blocksize);
+    // create the outer hash, the key block is already in the outer state
+    ctx->hashctx = ctx->outer;
     ctx->hash_update(&ctx->hashctx, intermediate, ctx->hashsize);
     ctx->hash_final(&ctx->hashctx, mac);
 }
 
-void hmac(const uint8_t *input, size_t inlen, uint8_t *key, size_t keylen, uint8_t *mac, int hashtype)
+int hmac(const uint8_t *input, size_t inlen, uint8_t *key, size_t keylen, uint8_t *mac, int hashtype)
+{
+    struct hmac_context ctx;
+
+    // Hashes with their own functions skip the function pointers
+    switch(hashtype)
+    {
+        case HMAC_MD5:
+            hmac_md5(input, inlen, key, keylen, mac);
+            return 0;
+        case HMAC_SHA1:
+            hmac_sha1(input, inlen, key, keylen, mac);
+            return 0;
+        case HMAC_SHA2_224:
+            hmac_sha2_224(input, inlen, key, keylen, mac);
+            return 0;
+        case HMAC_SHA2_256:
+            hmac_sha2_256(input, inlen, key, keylen, mac);
+            return 0;
+        case HMAC_SHA2_384:
+            hmac_sha2_384(input, inlen, key, keylen, mac);
+            return 0;
+        case HMAC_SHA2_512:
+            hmac_sha2_512(input, inlen, key, keylen, mac);
+            return 0;
+    }
+
+    if(hmac_init(&ctx, key, keylen, hashtype) != 0)
+        return -1;
+    hmac_update(&ctx, input, inlen);
+    hmac_final(&ctx, mac);
+    return 0;
+}
+
+void hmac_with_key(const struct hmac_key *hkey, const uint8_t *input, size_t inlen, uint8_t *mac)
 {
     struct hmac_context ctx;
-    hmac_init(&ctx, key, keylen, hashtype);
+    hmac_init_key(&ctx, hkey);
     hmac_update(&ctx, input, inlen);
     hmac_final(&ctx, mac);
 }
 
+/* The functions for one hash, with its context type and sizes known at compile
+ * time. hmac_NAME_setkey feeds the key blocks into the inner and outer states.
+ */
+#define HMAC_FUNCTIONS(name, ctxtype, blocksize, hashsize) \
+static void hmac_##name##_setkey(ctxtype *inner, ctxtype *outer, const uint8_t *key, size_t keylen) \
+{ \
+    uint8_t block[blocksize] = {0}; \
+ \
+    if(keylen > blocksize) \
+    { \
+        name##_init(inner); \
+        name##_update(inner, key, keylen); \
+        name##_final(inner, block); \
+    } \
+    else \
+        memcpy(block, key, keylen); \
+ \
+    hmac_xorkey(block, blocksize, HMAC_IPAD); \
+    name##_init(inner); \
+    name##_update(inner, block, blocksize); \
+    hmac_xorkey(block, blocksize, HMAC_IPAD ^ HMAC_OPAD); \
+    name##_init(outer); \
+    name##_update(outer, block, blocksize); \
+    memset(block, 0, sizeof(block)); \
+} \
+ \
+void hmac_##name##_key_init(struct hmac_##name##_key *hkey, const uint8_t *key, size_t keylen) \
+{ \
+    hmac_##name##_setkey(&hkey->inner, &hkey->outer, key, keylen); \
+} \
+ \
+void hmac_##name##_init_key(struct hmac_##name##_context *ctx, const struct hmac_##name##_key *hkey) \
+{ \
+    ctx->hashctx = hkey->inner; \
+    ctx->outer = hkey->outer; \
+} \
+ \
+void hmac_##name##_init(struct hmac_##name##_context *ctx, const uint8_t *key, size_t keylen) \
+{ \
+    hmac_##name##_setkey(&ctx->hashctx, &ctx->outer, key, keylen); \
+} \
+ \
+void hmac_##name##_update(struct hmac_##name##_context *ctx, const uint8_t *buffer, size_t len) \
+{ \
+    name##_update(&ctx->hashctx, buffer, len); \
+} \
+ \
+void hmac_##name##_final(struct hmac_##name##_context *ctx, uint8_t *mac) \
+{ \
+    uint8_t intermediate[hashsize]; \
+ \
+    name##_final(&ctx->hashctx, intermediate); \
+    ctx->hashctx = ctx->outer; \
+    name##_update(&ctx->hashctx, intermediate, hashsize); \
+    name##_final(&ctx->hashctx, mac); \
+} \
+ \
+void hmac_##name(const uint8_t *input, size_t inlen, const uint8_t *key, size_t keylen, uint8_t *mac) \
+{ \
+    struct hmac_##name##_context ctx; \
+    hmac_##name##_init(&ctx, key, keylen); \
+    hmac_##name##_update(&ctx, input, inlen); \
+    hmac_##name##_final(&ctx, mac); \
+}
+
+HMAC_FUNCTIONS(md5, struct md5_context, 64, 16)
+HMAC_FUNCTIONS(sha1, struct sha1_context, 64, 20)
+HMAC_FUNCTIONS(sha2_224, struct sha2_context, 64, 28)
+HMAC_FUNCTIONS(sha2_256, struct sha2_context, 64, 32)
+HMAC_FUNCTIONS(sha2_384, struct sha2_context, 128, 48)
+HMAC_FUNCTIONS(sha2_512, struct sha2_context, 128, 64)
+
+/* Batches of messages under one key. The inner hashes of all messages start
+ * from the inner state of the key and go through the multi buffer hash in one
+ * go so the lanes are refilled across the whole batch, their results are then
+ * hashed the same way from the outer state. The inner hashes are kept in macs,
+ * the multi buffer code copies a message shorter than a block before it writes
+ * the hash so the outer hash can work in place. Every outer message is a
+ * single block, so the outer hashes can go in chunks of HMAC_BATCH without
+ * leaving lanes idle as long as it is a multiple of the lane count.
+ */
+#define HMAC_BATCH 64
+
+#define HMAC_XN_FUNCTION(name, hashsize) \
+void hmac_##name##_xN(const struct hmac_##name##_key *hkey, const uint8_t *buffers[], const size_t lens[], \
+                      uint8_t *macs[], size_t count) \
+{ \
+    size_t hashlens[HMAC_BATCH]; \
+ \
+    for(size_t i = 0; i < HMAC_BATCH; i++) \
+        hashlens[i] = hashsize; \
+    name##_xN_ctx(&hkey->inner, buffers, lens, macs, count); \
+    for(size_t done = 0; done < count; done += HMAC_BATCH) \
+    { \
+        size_t n = (count - done < HMAC_BATCH) ? count - done : HMAC_BATCH; \
+        name##_xN_ctx(&hkey->outer, (const uint8_t **)(macs + done), hashlens, macs + done, n); \
+    } \
+}
+
+HMAC_XN_FUNCTION(sha1, 20)
+HMAC_XN_FUNCTION(sha2_256, 32)
+HMAC_XN_FUNCTION(sha2_512, 64)
@@ -0,0 +1,88 @@
+/* Copyright (C) 2011 by clueless <clueless@thunked.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __NOTCRYPTO_CPU_H_
+#define __NOTCRYPTO_CPU_H_
+
+/* Internal helpers for the accelerated code paths. The accelerated kernels are
+ * only built for X86 with a GCC compatible compiler, every one of them is
+ * picked at runtime based on what the CPU supports and always has the portable
+ * code as its fallback. Define NOTCRYPTO_DISABLE_SIMD to build the portable
+ * code only, or NOTCRYPTO_DISABLE_SHANI to leave out the SHA extensions so the
+ * SSSE3 and AVX kernels they take over from can be tested on CPUs that have
+ * them.
+ */
+# if !defined(NOTCRYPTO_DISABLE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define NOTCRYPTO_X86_SIMD
+#  include <immintrin.h>
+
+#  ifdef NOTCRYPTO_DISABLE_SHANI
+#   define cpu_has_shani() 0
+#  else
+#   define cpu_has_shani() (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+#  endif
+#  define cpu_has_ssse3()  __builtin_cpu_supports("ssse3")
+#  define cpu_has_avx()    __builtin_cpu_supports("avx")
+#  define cpu_has_avx2()   __builtin_cpu_supports("avx2")
+#  define cpu_has_avx512() (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2"))
+
+// Transpose 8 rows of 8 32 bit words, used by the multi buffer code to turn 8
+// message blocks into vectors holding the same word of every message
+__attribute__((target("avx2")))
+static inline void cpu_transpose_8x32(__m256i *r)
+{
+    __m256i t[8], u[8];
+
+    for(int i = 0; i < 4; i++)
+    {
+        t[2 * i]     = _mm256_unpacklo_epi32(r[2 * i], r[2 * i + 1]);
+        t[2 * i + 1] = _mm256_unpackhi_epi32(r[2 * i], r[2 * i + 1]);
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        u[4 * i]     = _mm256_unpacklo_epi64(t[4 * i],     t[4 * i + 2]);
+        u[4 * i + 1] = _mm256_unpackhi_epi64(t[4 * i],     t[4 * i + 2]);
+        u[4 * i + 2] = _mm256_unpacklo_epi64(t[4 * i + 1], t[4 * i + 3]);
+        u[4 * i + 3] = _mm256_unpackhi_epi64(t[4 * i + 1], t[4 * i + 3]);
+    }
+    for(int i = 0; i < 4; i++)
+    {
+        r[i]     = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+// Transpose 4 rows of 4 64 bit words
+__attribute__((target("avx2")))
+static inline void cpu_transpose_4x64(__m256i *r)
+{
+    __m256i t0 = _mm256_unpacklo_epi64(r[0], r[1]);
+    __m256i t1 = _mm256_unpackhi_epi64(r[0], r[1]);
+    __m256i t2 = _mm256_unpacklo_epi64(r[2], r[3]);
+    __m256i t3 = _mm256_unpackhi_epi64(r[2], r[3]);
+
+    r[0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+    r[1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+    r[2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+    r[3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+# endif
+
+#endif
@@ -25,6 +25,7 @@
 # include "md5.h"
 # include "sha1.h" 
 # include "sha2.h"
+# include "skein.h"
 
 # ifndef NOTCRYPTO_DISABLE_WARNING
 #  warning "This code is insecure and should never be used. See README for more information."
@@ -41,34 +42,192 @@ enum hmac_hashfunctions
     HMAC_SHA2_224,
     HMAC_SHA2_256,
     HMAC_SHA2_384,
-    HMAC_SHA2_512
+    HMAC_SHA2_512,
+    HMAC_SHA2_512_224,
+    HMAC_SHA2_512_256,
+    HMAC_SKEIN_512,
+    HMAC_SKEIN_1024
 };
 
 typedef void (*hashinit_t)(void *);
 typedef void (*hashupdate_t)(void *, const uint8_t *, size_t);
 typedef void (*hashfinal_t)(void *, const uint8_t *);
 
+union hmac_hashctx
+{
+    struct md2_context md2;
+    struct md5_context md5;
+    struct sha1_context sha1;
+    struct sha2_context sha2;
+    struct skein_context skein;
+};
+
+/* A key with the hash states after the key xor ipad block and the key xor opad
+ * block worked out once. Every MAC started from it with hmac_init_key or
+ * hmac_with_key copies those states instead of hashing the two key blocks
+ * again, for short messages that is half the work.
+ */
+struct hmac_key
+{
+    int hashtype;
+    union hmac_hashctx inner;
+    union hmac_hashctx outer;
+    hashinit_t hash_init;
+    hashupdate_t hash_update;
+    hashfinal_t hash_final;
+    size_t hashsize;
+    size_t blocksize;
+};
+
 struct hmac_context
 {
     int hashtype;
-    union
-    {
-        struct md2_context md2;
-        struct md5_context md5;
-        struct sha1_context sha1;
-        struct sha2_context sha2;
-    } hashctx;
+    union hmac_hashctx hashctx;
+    union hmac_hashctx outer;   // State after the key xor opad block
     hashinit_t hash_init;
     hashupdate_t hash_update;
     hashfinal_t hash_final;
-    uint8_t key[128];    // Make sure to upgrade this when introducing a hash algo with bigger blocksize
     size_t hashsize;
     size_t blocksize;
 };
 
-void hmac_init(struct hmac_context *ctx, const uint8_t *key, size_t keylen, int hashtype);
+/* hmac_key_init, hmac_init and hmac return -1 for an unknown hashtype, the key
+ * or context is then left with a hashsize of 0 and must not be used.
+ */
+int hmac_key_init(struct hmac_key *hkey, const uint8_t *key, size_t keylen, int hashtype);
+void hmac_init_key(struct hmac_context *ctx, const struct hmac_key *hkey);
+void hmac_with_key(const struct hmac_key *hkey, const uint8_t *input, size_t inlen, uint8_t *mac);
+int hmac_init(struct hmac_context *ctx, const uint8_t *key, size_t keylen, int hashtype);
 void hmac_update(struct hmac_context *ctx, const uint8_t *buffer, size_t len);
 void hmac_final(struct hmac_context *ctx, const uint8_t *mac);
-void hmac(const uint8_t *input, size_t inlen, uint8_t *key, size_t keylen, uint8_t *mac, int hashtype);
+int hmac(const uint8_t *input, size_t inlen, uint8_t *key, size_t keylen, uint8_t *mac, int hashtype);
+
+/* HMAC for a single hash function with direct calls into the hash and a
+ * context that only holds the two states of that hash. Same use as the
+ * generic functions above, hmac falls through to these for their hash types.
+ */
+struct hmac_md5_key
+{
+    struct md5_context inner;
+    struct md5_context outer;
+};
+
+struct hmac_md5_context
+{
+    struct md5_context hashctx;
+    struct md5_context outer;
+};
+
+void hmac_md5_key_init(struct hmac_md5_key *hkey, const uint8_t *key, size_t keylen);
+void hmac_md5_init_key(struct hmac_md5_context *ctx, const struct hmac_md5_key *hkey);
+void hmac_md5_init(struct hmac_md5_context *ctx, const uint8_t *key, size_t keylen);
+void hmac_md5_update(struct hmac_md5_context *ctx, const uint8_t *buffer, size_t len);
+void hmac_md5_final(struct hmac_md5_context *ctx, uint8_t *mac);
+void hmac_md5(const uint8_t *input, size_t inlen, const uint8_t *key, size_t keylen, uint8_t *mac);
+
+struct hmac_sha1_key
+{
+    struct sha1_context inner;
+    struct sha1_context outer;
+};
+
+struct hmac_sha1_context
+{
+    struct sha1_context hashctx;
+    struct sha1_context outer;
+};
+
+void hmac_sha1_key_init(struct hmac_sha1_key *hkey, const uint8_t *key, size_t keylen);
+void hmac_sha1_init_key(struct hmac_sha1_context *ctx, const struct hmac_sha1_key *hkey);
+void hmac_sha1_init(struct hmac_sha1_context *ctx, const uint8_t *key, size_t keylen);
+void hmac_sha1_update(struct hmac_sha1_context *ctx, const uint8_t *buffer, size_t len);
+void hmac_sha1_final(struct hmac_sha1_context *ctx, uint8_t *mac);
+void hmac_sha1(const uint8_t *input, size_t inlen, const uint8_t *key, size_t keylen, uint8_t *mac);
+
+struct hmac_sha2_224_key
+{
+    struct sha2_context inner;
+    struct sha2_context outer;
+};
+
+struct hmac_sha2_224_context
+{
+    struct sha2_context hashctx;
+    struct sha2_context outer;
+};
+
+void hmac_sha2_224_key_init(struct hmac_sha2_224_key *hkey, const uint8_t *key, size_t keylen);
+void hmac_sha2_224_init_key(struct hmac_sha2_224_context *ctx, const struct hmac_sha2_224_key *hkey);
+void hmac_sha2_224_init(struct hmac_sha2_224_context *ctx, const uint8_t *key, size_t keylen);
+void hmac_sha2_224_update(struct hmac_sha2_224_context *ctx, const uint8_t *buffer, size_t len);
+void hmac_sha2_224_final(struct hmac_sha2_224_context *ctx, uint8_t *mac);
+void hmac_sha2_224(const uint8_t *input, size_t inlen, const uint8_t *key, size_t keylen, uint8_t *mac);
+
+struct hmac_sha2_256_key
+{
+    struct sha2_context inner;
+    struct sha2_context outer;
+};
+
+struct hmac_sha2_256_context
+{
+    struct sha2_context hashctx;
+    struct sha2_context outer;
+};
+
+void hmac_sha2_256_key_init(struct hmac_sha2_256_key *hkey, const uint8_t *key, size_t keylen);
+void hmac_sha2_256_init_key(struct hmac_sha2_256_context *ctx, const struct hmac_sha2_256_key *hkey);
+void hmac_sha2_256_init(struct hmac_sha2_256_context *ctx, const uint8_t *key, size_t keylen);
+void hmac_sha2_256_update(struct hmac_sha2_256_context *ctx, const uint8_t *buffer, size_t len);
+void hmac_sha2_256_final(struct hmac_sha2_256_context *ctx, uint8_t *mac);
+void hmac_sha2_256(const uint8_t *input, size_t inlen, const uint8_t *key, size_t keylen, uint8_t *mac);
+
+struct hmac_sha2_384_key
+{
+    struct sha2_context inner;
+    struct sha2_context outer;
+};
+
+struct hmac_sha2_384_context
+{
+    struct sha2_context hashctx;
+    struct sha2_context outer;
+};
+
+void hmac_sha2_384_key_init(struct hmac_sha2_384_key *hkey, const uint8_t *key, size_t keylen);
+void hmac_sha2_384_init_key(struct hmac_sha2_384_context *ctx, const struct hmac_sha2_384_key *hkey);
+void hmac_sha2_384_init(struct hmac_sha2_384_context *ctx, const uint8_t *key, size_t keylen);
+void hmac_sha2_384_update(struct hmac_sha2_384_context *ctx, const uint8_t *buffer, size_t len);
+void hmac_sha2_384_final(struct hmac_sha2_384_context *ctx, uint8_t *mac);
+void hmac_sha2_384(const uint8_t *input, size_t inlen, const uint8_t *key, size_t keylen, uint8_t *mac);
+
+struct hmac_sha2_512_key
+{
+    struct sha2_context inner;
+    struct sha2_context outer;
+};
+
+struct hmac_sha2_512_context
+{
+    struct sha2_context hashctx;
+    struct sha2_context outer;
+};
+
+void hmac_sha2_512_key_init(struct hmac_sha2_512_key *hkey, const uint8_t *key, size_t keylen);
+void hmac_sha2_512_init_key(struct hmac_sha2_512_context *ctx, const struct hmac_sha2_512_key *hkey);
+void hmac_sha2_512_init(struct hmac_sha2_512_context *ctx, const uint8_t *key, size_t keylen);
+void hmac_sha2_512_update(struct hmac_sha2_512_context *ctx, const uint8_t *buffer, size_t len);
+void hmac_sha2_512_final(struct hmac_sha2_512_context *ctx, uint8_t *mac);
+void hmac_sha2_512(const uint8_t *input, size_t inlen, const uint8_t *key, size_t keylen, uint8_t *mac);
+
+// MAC count messages under one key, macs[i] receives the MAC of the lens[i]
+// bytes at buffers[i]. Uses the multi buffer hashes for the inner and the outer
+// hashes and gives exactly the same MACs as hmac.
+void hmac_sha1_xN(const struct hmac_sha1_key *hkey, const uint8_t *buffers[], const size_t lens[],
+                  uint8_t *macs[], size_t count);
+void hmac_sha2_256_xN(const struct hmac_sha2_256_key *hkey, const uint8_t *buffers[], const size_t lens[],
+                      uint8_t *macs[], size_t count);
+void hmac_sha2_512_xN(const struct hmac_sha2_512_key *hkey, const uint8_t *buffers[], const size_t lens[],
+                      uint8_t *macs[], size_t count);
 
 #endif
@@ -41,4 +41,9 @@ void md5_update(struct md5_context *ctx, const uint8_t *buffer, size_t len);
 void md5_final(struct md5_context *ctx, uint8_t *hash);
 void md5(const uint8_t *buffer, size_t len, uint8_t *hash);
 
+// Hash count independent messages at once, hashes[i] receives the hash of the
+// lens[i] bytes at buffers[i]. Uses 16 (AVX-512) or 8 (AVX2) lanes when the CPU
+// supports it and gives exactly the same hashes as md5.
+void md5_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count);
+
 #endif
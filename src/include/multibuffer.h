@@ -0,0 +1,181 @@
+/* Copyright (C) 2011 by clueless <clueless@thunked.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __NOTCRYPTO_MULTIBUFFER_H_
+#define __NOTCRYPTO_MULTIBUFFER_H_
+
+/* Internal driver for the multi buffer hashes. Every lane of a vector register
+ * hashes its own message, the lanes are refilled with the next message as soon
+ * as they are done so messages of different lengths keep all lanes busy. The
+ * state of all lanes is kept in memory as state[word * width + lane] between
+ * blocks, the hash specific part is only the function that runs one block
+ * through all lanes.
+ */
+
+# include <stddef.h>
+# include <stdint.h>
+# include <string.h>
+
+// Merkle-Damgard hash the driver works on
+struct multibuffer_hash
+{
+    size_t blocksize;       // Block size in bytes, 64 or 128
+    size_t lenbytes;        // Size of the length field in the padding
+    int bigendian;          // Byte order of the length field and the state words
+    size_t wordsize;        // Size of a state word in bytes, 4 or 8
+    size_t words;           // Number of state words
+    size_t hashsize;        // Number of state bytes that make up the hash
+    const void *state;      // Starting state of every lane
+    uint64_t prefix[2];     // Bytes hashed into the starting state already, low word first
+};
+
+// Book keeping for one lane
+struct multibuffer_lane
+{
+    const uint8_t *buffer;  // Message that is hashed in this lane
+    size_t blocks;          // Number of full blocks in the message
+    size_t total;           // Number of blocks including the padding
+    size_t next;            // Next block that goes into the lane
+    uint8_t *hash;          // Where the hash goes
+    int busy;               // Set while the lane holds a message
+    uint8_t tail[256];      // Last partial block of the message with the padding applied
+};
+
+// Runs one block through every lane of the state
+typedef void (*multibuffer_lanefunc_t)(void *state, const uint8_t **blocks);
+
+static const uint8_t multibuffer_zero_block[128] = {0};
+
+// Prepare a lane for a message
+static inline void multibuffer_lane_init(const struct multibuffer_hash *mb, struct multibuffer_lane *lane,
+                                         const uint8_t *buffer, size_t len, uint8_t *hash)
+{
+    size_t rest = len % mb->blocksize;
+    uint64_t lo = mb->prefix[0] + len;
+    uint64_t hi = mb->prefix[1] + (lo < len);
+
+    // Length in bits
+    hi = (hi << 3) | (lo >> 61);
+    lo <<= 3;
+
+    lane->buffer = buffer;
+    lane->blocks = len / mb->blocksize;
+    lane->total  = lane->blocks + ((rest + 1 + mb->lenbytes > mb->blocksize) ? 2 : 1);
+    lane->next   = 0;
+    lane->hash   = hash;
+    lane->busy   = 1;
+
+    memset(lane->tail, 0, sizeof(lane->tail));
+    if(rest > 0)
+        memcpy(lane->tail, buffer + len - rest, rest);
+    lane->tail[rest] = 0x80;
+
+    uint8_t *end = lane->tail + (lane->total - lane->blocks) * mb->blocksize;
+    for(size_t i = 0; i < mb->lenbytes; i++)
+    {
+        uint8_t byte = (uint8_t)((i < 8) ? lo >> (8 * i) : hi >> (8 * (i - 8)));
+        if(mb->bigendian)
+            end[-1 - (ptrdiff_t)i] = byte;
+        else
+            end[i - mb->lenbytes] = byte;
+    }
+}
+
+// Hand out the next block of the lane
+static inline const uint8_t *multibuffer_lane_block(const struct multibuffer_hash *mb, struct multibuffer_lane *lane)
+{
+    size_t n = lane->next++;
+    if(n < lane->blocks)
+        return lane->buffer + mb->blocksize * n;
+    return lane->tail + mb->blocksize * (n - lane->blocks);
+}
+
+// Write the hash of a lane that is done
+static inline void multibuffer_lane_final(const struct multibuffer_hash *mb, const uint8_t *state,
+                                          size_t width, size_t l, uint8_t *hash)
+{
+    for(size_t i = 0; i < mb->hashsize; i++)
+    {
+        const uint8_t *word = state + ((i / mb->wordsize) * width + l) * mb->wordsize;
+        uint64_t value;
+        if(mb->wordsize == 4)
+        {
+            uint32_t value32;
+            memcpy(&value32, word, 4);
+            value = value32;
+        }
+        else
+            memcpy(&value, word, 8);
+
+        size_t shift = mb->bigendian ? mb->wordsize - 1 - i % mb->wordsize : i % mb->wordsize;
+        hash[i] = (uint8_t)(value >> (8 * shift));
+    }
+}
+
+// Hash count messages with width lanes, width is at most 16 and the state at
+// most 16 words of 8 bytes per lane. A message with a NULL hash pointer is run
+// through its lane but its hash is not written.
+static inline void multibuffer_run(const struct multibuffer_hash *mb, size_t width, multibuffer_lanefunc_t lanefunc,
+                                   const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    struct multibuffer_lane lanes[16];
+    const uint8_t *blocks[16];
+    uint64_t state[16 * 16];
+    uint8_t *bytes = (uint8_t *)state;
+    size_t active = 0, next = 0;
+
+    for(size_t l = 0; l < width; l++)
+        lanes[l].busy = 0;
+
+    for(;;)
+    {
+        // Start the next messages in the idle lanes
+        for(size_t l = 0; l < width && next < count; l++)
+        {
+            if(lanes[l].busy)
+                continue;
+            multibuffer_lane_init(mb, &lanes[l], buffers[next], lens[next], hashes[next]);
+            for(size_t i = 0; i < mb->words; i++)
+                memcpy(bytes + (i * width + l) * mb->wordsize, (const uint8_t *)mb->state + i * mb->wordsize, mb->wordsize);
+            next++;
+            active++;
+        }
+        if(active == 0)
+            break;
+
+        for(size_t l = 0; l < width; l++)
+            blocks[l] = lanes[l].busy ? multibuffer_lane_block(mb, &lanes[l]) : multibuffer_zero_block;
+
+        lanefunc(state, blocks);
+
+        // Hand out the hashes of the lanes that are done
+        for(size_t l = 0; l < width; l++)
+        {
+            if(!lanes[l].busy || lanes[l].next < lanes[l].total)
+                continue;
+            if(lanes[l].hash != NULL)
+                multibuffer_lane_final(mb, bytes, width, l, lanes[l].hash);
+            lanes[l].busy = 0;
+            active--;
+        }
+    }
+}
+
+#endif
@@ -40,4 +40,14 @@ void sha1_update(struct sha1_context *ctx, const uint8_t *buffer, size_t len);
 void sha1_final(struct sha1_context *ctx, uint8_t *hash);
 void sha1(const uint8_t *buffer, size_t len, uint8_t *hash);
 
+// Hash count independent messages at once, hashes[i] receives the hash of the
+// lens[i] bytes at buffers[i]. Uses 16 (AVX-512) or 8 (AVX2) lanes when the CPU
+// supports it and gives exactly the same hashes as sha1.
+void sha1_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count);
+
+// Same, but every message continues from the state in ctx as if it was hashed
+// with a copy of ctx. Only uses the lanes when ctx has no partial block buffered.
+void sha1_xN_ctx(const struct sha1_context *ctx, const uint8_t *buffers[], const size_t lens[],
+                 uint8_t *hashes[], size_t count);
+
 #endif
@@ -36,13 +36,13 @@ struct sha2_context_32bit
     uint64_t len;
 };
 
-// 64 bit context for SHA2-384 and SHA2-512
+// 64 bit context for SHA2-384, SHA2-512, SHA2-512/256 and SHA2-512/224
 struct sha2_context_64bit
 {
     uint8_t buffer[128];
     uint64_t state[8];
     size_t bufused;
-    uint64_t len; // Should be 128 bits
+    uint64_t len[2]; // 128 bit byte count, len[0] holds the low 64 bits
 };
 
 // Unified context to make the API less complex
@@ -65,6 +65,17 @@ void sha2_224_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len
 void sha2_224_final(struct sha2_context *ctx, uint8_t *hash);
 void sha2_224(const uint8_t *buffer, size_t len, uint8_t *hash);
 
+// Hash count independent messages at once, hashes[i] receives the hash of the
+// lens[i] bytes at buffers[i]. Uses 16 (AVX-512) or 8 (AVX2) lanes when the CPU
+// supports it and gives exactly the same hashes as sha2_256/sha2_224.
+void sha2_256_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count);
+void sha2_224_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count);
+
+// Same, but every message continues from the state in ctx as if it was hashed
+// with a copy of ctx. Only uses the lanes when ctx has no partial block buffered.
+void sha2_256_xN_ctx(const struct sha2_context *ctx, const uint8_t *buffers[], const size_t lens[],
+                     uint8_t *hashes[], size_t count);
+
 void sha2_512_init(struct sha2_context *ctx);
 void sha2_512_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len);
 void sha2_512_final(struct sha2_context *ctx, uint8_t *hash);
@@ -75,5 +86,25 @@ void sha2_384_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len
 void sha2_384_final(struct sha2_context *ctx, uint8_t *hash);
 void sha2_384(const uint8_t *buffer, size_t len, uint8_t *hash);
 
+// SHA2-512 truncated to 256 and 224 bits with their own initial values
+void sha2_512_256_init(struct sha2_context *ctx);
+void sha2_512_256_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len);
+void sha2_512_256_final(struct sha2_context *ctx, uint8_t *hash);
+void sha2_512_256(const uint8_t *buffer, size_t len, uint8_t *hash);
+
+void sha2_512_224_init(struct sha2_context *ctx);
+void sha2_512_224_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len);
+void sha2_512_224_final(struct sha2_context *ctx, uint8_t *hash);
+void sha2_512_224(const uint8_t *buffer, size_t len, uint8_t *hash);
+
+// Multi buffer versions of the 64 bit hashes, these use 8 (AVX-512) or 4
+// (AVX2) lanes when the CPU supports it
+void sha2_512_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count);
+void sha2_384_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count);
+void sha2_512_256_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count);
+void sha2_512_224_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count);
+void sha2_512_xN_ctx(const struct sha2_context *ctx, const uint8_t *buffers[], const size_t lens[],
+                     uint8_t *hashes[], size_t count);
+
 
 #endif
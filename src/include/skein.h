@@ -0,0 +1,52 @@
+/* Copyright (C) 2011 by clueless <clueless@thunked.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __NOTCRYPTO_SKEIN_H_
+#define __NOTCRYPTO_SKEIN_H_
+
+# include <stddef.h>
+# include <stdint.h>
+
+# ifndef NOTCRYPTO_DISABLE_WARNING
+#  warning "This code is insecure and should never be used. See README for more information."
+# endif
+
+// Context for Skein-512 and Skein-1024, the output is as long as the state
+struct skein_context
+{
+    uint8_t buffer[128];
+    uint64_t state[16];
+    size_t bufused;
+    size_t blocksize;
+    uint64_t position;  // Bytes of the current UBI call processed so far
+    int first;          // Next block is the first of the current UBI call
+};
+
+void skein_512_init(struct skein_context *ctx);
+void skein_512_update(struct skein_context *ctx, const uint8_t *buffer, size_t len);
+void skein_512_final(struct skein_context *ctx, uint8_t *hash);
+void skein_512(const uint8_t *buffer, size_t len, uint8_t *hash);
+
+void skein_1024_init(struct skein_context *ctx);
+void skein_1024_update(struct skein_context *ctx, const uint8_t *buffer, size_t len);
+void skein_1024_final(struct skein_context *ctx, uint8_t *hash);
+void skein_1024(const uint8_t *buffer, size_t len, uint8_t *hash);
+
+#endif
@@ -31,4 +31,156 @@
 enum threefish_op {THREEFISH_ENCRYPT, THREEFISH_DECRYPT};
 int threefish(int op, size_t blocksize, const uint8_t *inkey, const uint8_t *intweak, uint8_t *plaintext);
 
+/* Expanded key for encrypting many blocks under the same key. threefish_setkey
+ * computes the extra key word and the key part of every subkey once, after that
+ * only the tweak is processed per block. blocksize is 32, 64 or 128 bytes like
+ * for threefish, threefish_setkey returns -1 for any other size.
+ */
+struct threefish_key
+{
+    int rounds;
+    int words;
+    uint64_t subkeys[21 * 16];
+};
+
+int threefish_setkey(struct threefish_key *key, size_t blocksize, const uint8_t *inkey);
+void threefish_encrypt_block(const struct threefish_key *key, const uint8_t *intweak, uint8_t *plaintext);
+void threefish_decrypt_block(const struct threefish_key *key, const uint8_t *intweak, uint8_t *ciphertext);
+
+/* One block of Skein's UBI chaining for 64 and 128 byte blocks: block is
+ * encrypted with state as the key and intweak as the tweak, and state becomes
+ * the result xored with block. The subkeys are worked out while encrypting
+ * instead of setting up a threefish_key for every block.
+ */
+void threefish_ubi(size_t blocksize, uint64_t *state, const uint8_t *block, const uint8_t *intweak);
+
+// Encrypt or decrypt count independent 64 byte blocks in place, blocks[i] with
+// keys[i] and tweaks[i]. The keys can all point to the same threefish_key or
+// to different ones, they must all be set up for 64 byte blocks or -1 is
+// returned. Uses 8 (AVX-512) or 4 (AVX2) lanes when the CPU supports it.
+int threefish_512_xN(int op, const struct threefish_key *keys[], const uint8_t *tweaks[], uint8_t *blocks[], size_t count);
+
+/* Counter mode, encryption and decryption are the same operation. Block i of
+ * the key stream is the nonce (one block long) encrypted with counter + i as
+ * the low 64 bits of the tweak and zero as the high 64 bits. len doesn't have
+ * to be a multiple of the block size and in and out can be the same buffer.
+ * The work is split over up to threads threads, the output is the same for any
+ * number of threads.
+ */
+void threefish_ctr(const struct threefish_key *key, const uint8_t *nonce, uint64_t counter,
+                   const uint8_t *in, uint8_t *out, size_t len, int threads);
+
+/* ECB and CBC mode with the same tweak for every block. The input is read from
+ * in and the result written to out, which can be the same buffer, neither has
+ * to be aligned. len must be a multiple of the block size or -1 is returned.
+ * CBC decryption works on many blocks at once since it only needs the
+ * ciphertext.
+ */
+int threefish_ecb(int op, const struct threefish_key *key, const uint8_t *tweak,
+                  const uint8_t *in, uint8_t *out, size_t len);
+int threefish_cbc(int op, const struct threefish_key *key, const uint8_t *tweak, const uint8_t *iv,
+                  const uint8_t *in, uint8_t *out, size_t len);
+
+/* Encrypt or decrypt count sectors of sectorsize bytes, the first one being
+ * sector number sector. Every block is encrypted on its own with the sector
+ * number as the low 64 bits of the tweak and the index of the block inside the
+ * sector as the high 64 bits, so any sector can be decrypted without touching
+ * the others. sectorsize must be a multiple of the block size or -1 is
+ * returned. in and out can be the same buffer.
+ */
+int threefish_sectors(int op, const struct threefish_key *key, uint64_t sector, size_t sectorsize,
+                      const uint8_t *in, uint8_t *out, size_t count);
+
+/* Reproducible pseudo random bytes, the stream is the counter mode key stream
+ * of threefish_ctr under the seed as key and an all zero nonce. Every call to
+ * threefish_rng_fill starts at a block boundary, the unused bytes of its last
+ * block are thrown away. threefish_rng_seek jumps to any block of the stream,
+ * so threads with their own threefish_rng can fill different parts of the same
+ * stream. blocksize is 32, 64 or 128 and the seed is that many bytes long,
+ * threefish_rng_init returns -1 for any other size.
+ */
+struct threefish_rng
+{
+    struct threefish_key key;
+    uint8_t nonce[128];
+    uint64_t counter;   // Next block of the stream
+};
+
+int threefish_rng_init(struct threefish_rng *rng, size_t blocksize, const uint8_t *seed);
+void threefish_rng_seek(struct threefish_rng *rng, uint64_t block);
+void threefish_rng_fill(struct threefish_rng *rng, uint8_t *out, size_t len);
+
+/* Counter mode encryption with an HMAC (encrypt-then-MAC) in a single pass over
+ * the data. The HMAC covers the nonce, the counter as 8 little endian bytes and
+ * then the ciphertext, so a message can't be moved to another nonce or counter.
+ * mackey, mackeylen and hashtype are passed on to hmac_init, mac is as long as
+ * the hash of hashtype. Both return -1 without touching out for an unknown
+ * hashtype. Decryption checks the MAC while decrypting, when it doesn't match
+ * out is cleared and -1 is returned.
+ */
+int threefish_ctr_hmac_encrypt(const struct threefish_key *key, const uint8_t *nonce, uint64_t counter,
+                               const uint8_t *mackey, size_t mackeylen, int hashtype,
+                               const uint8_t *in, uint8_t *out, size_t len, uint8_t *mac);
+int threefish_ctr_hmac_decrypt(const struct threefish_key *key, const uint8_t *nonce, uint64_t counter,
+                               const uint8_t *mackey, size_t mackeylen, int hashtype,
+                               const uint8_t *in, uint8_t *out, size_t len, const uint8_t *mac);
+
+/* Parallelizable MAC in the style of PMAC. Every block is encrypted with its
+ * block number as tweak, so blocks don't depend on each other. The tag is one
+ * block long. threefish_mac gives the same tag as the streaming functions and
+ * splits the work over up to threads threads. The key must stay around until
+ * threefish_mac_final.
+ */
+struct threefish_mac
+{
+    const struct threefish_key *key;
+    uint64_t domain;    // Keeps the associated data of threefish_aead apart
+    uint8_t sum[128];
+    uint8_t buffer[128];
+    size_t bufused;
+    uint64_t blocks;    // Blocks xored into sum so far
+};
+
+void threefish_mac_init(struct threefish_mac *ctx, const struct threefish_key *key);
+void threefish_mac_update(struct threefish_mac *ctx, const uint8_t *buffer, size_t len);
+void threefish_mac_final(struct threefish_mac *ctx, uint8_t *tag);
+void threefish_mac(const struct threefish_key *key, const uint8_t *in, size_t len, uint8_t *tag, int threads);
+
+/* One pass authenticated encryption with associated data in the style of OCB,
+ * one cipher call per block. The nonce must never be used twice with the same
+ * key, the tag is one block long. threefish_aead_encrypt and decrypt do it all
+ * at once and split the work over up to threads threads, decryption returns -1
+ * and clears out when the tag doesn't match.
+ *
+ * The streaming functions give the same result: start with threefish_aead_init,
+ * pass the associated data with threefish_aead_ad, then the message with the
+ * update functions, which only take whole blocks and return -1 otherwise, and
+ * the rest with the final functions, which take any length. The output of
+ * threefish_aead_decrypt_update must not be used until
+ * threefish_aead_decrypt_final returns 0. The key must stay around until the
+ * final call.
+ */
+struct threefish_aead
+{
+    const struct threefish_key *key;
+    uint64_t nonce;
+    struct threefish_mac ad;    // MAC of the associated data
+    int hasad;
+    uint8_t checksum[128];      // Xor of the plaintext blocks
+    uint64_t blocks;            // Whole blocks done so far
+};
+
+void threefish_aead_init(struct threefish_aead *ctx, const struct threefish_key *key, uint64_t nonce);
+void threefish_aead_ad(struct threefish_aead *ctx, const uint8_t *ad, size_t len);
+int threefish_aead_encrypt_update(struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len);
+void threefish_aead_encrypt_final(struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len,
+                                  uint8_t *tag);
+int threefish_aead_decrypt_update(struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len);
+int threefish_aead_decrypt_final(struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len,
+                                 const uint8_t *tag);
+void threefish_aead_encrypt(const struct threefish_key *key, uint64_t nonce, const uint8_t *ad, size_t adlen,
+                            const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag, int threads);
+int threefish_aead_decrypt(const struct threefish_key *key, uint64_t nonce, const uint8_t *ad, size_t adlen,
+                           const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag, int threads);
+
 #endif
@@ -29,6 +29,7 @@
 
 #include <string.h>
 #include "md2.h"
+#include "cpu.h"
 
 // 256 byte table derived from digits of pi as provided by RFC 1319
 static const uint8_t sub_table[256] = {
@@ -171,3 +172,293 @@ void md2(const uint8_t *buffer, size_t len, uint8_t *hash)
     md2_update(&ctx, buffer, len);
     md2_final(&ctx, hash);
 }
+
+/* Multi buffer hashing. Every byte of a vector register belongs to a different
+ * message, so the serial chain of sub_table lookups runs for 16 or 32 messages
+ * at the same time. The state of all lanes is kept in memory as
+ * state[byte * width + lane], with the 48 bytes of the MD buffer first,
+ * followed by the 16 checksum bytes and L.
+ */
+
+#define MD2_LANE_MDBUFFER 0
+#define MD2_LANE_CHECKSUM 48
+#define MD2_LANE_L        64
+#define MD2_LANE_BYTES    65
+
+// Book keeping for one lane of the multi buffer code
+struct md2_lane
+{
+    const uint8_t *buffer;  // Message that is hashed in this lane
+    size_t blocks;          // Number of full blocks in the message
+    size_t next;            // Next block that goes into the lane
+    uint8_t *hash;          // Where the hash goes, NULL if the lane is idle
+    uint8_t tail[16];       // Last partial block of the message with the padding applied
+    uint8_t checksum[16];   // Copy of the checksum to feed as the final block
+};
+
+static const uint8_t md2_zero_block[16] = {0};
+
+// Prepare a lane for a message
+static void md2_lane_init(struct md2_lane *lane, const uint8_t *buffer, size_t len, uint8_t *hash)
+{
+    size_t rest = len % 16;
+
+    lane->buffer = buffer;
+    lane->blocks = len / 16;
+    lane->next   = 0;
+    lane->hash   = hash;
+
+    if(rest > 0)
+        memcpy(lane->tail, buffer + len - rest, rest);
+    memset(lane->tail + rest, 16 - rest, 16 - rest);
+}
+
+#ifdef NOTCRYPTO_X86_SIMD
+// Turn 16 byte blocks of width lanes into vectors of the same byte of every
+// lane, rows[i * width + lane] = blocks[lane][i]
+static void md2_transpose(uint8_t *rows, const uint8_t **blocks, size_t width)
+{
+    for(size_t l = 0; l < width; l++)
+        for(int i = 0; i < 16; i++)
+            rows[i * width + l] = blocks[l][i];
+}
+
+/* pshufb only looks at the low nibble of the index and returns 0 when bit 7 is
+ * set. sub_table is split in 16 tables of 16 bytes. For table k the index is
+ * xored with k << 4 and saturated with 0x70 so that bit 7 ends up set in every
+ * lane where the high nibble isn't k, all other tables return 0 for that lane.
+ * nibbles[k] holds k << 4 in every byte, nibbles[7] doubles as the 0x70.
+ */
+__attribute__((always_inline, target("ssse3")))
+static inline __m128i md2_sub_ssse3(__m128i x, const __m128i *tables, const __m128i *nibbles)
+{
+    __m128i r[16];
+    for(int k = 0; k < 16; k++)
+    {
+        __m128i idx = _mm_adds_epu8(_mm_xor_si128(x, nibbles[k]), nibbles[7]);
+        r[k] = _mm_shuffle_epi8(tables[k], idx);
+    }
+    // Combine as a tree, this is on the critical path of the MD buffer update
+    for(int n = 8; n > 0; n /= 2)
+        for(int k = 0; k < n; k++)
+            r[k] = _mm_or_si128(r[k], r[k + n]);
+    return r[0];
+}
+
+// Run one block through 16 lanes with SSSE3, checksum lanes that are not set in
+// update get fed a block without updating their checksum
+__attribute__((target("ssse3")))
+static void md2_lanes_ssse3(uint8_t *state, const uint8_t **blocks, const uint8_t *update)
+{
+    __m128i tables[16], nibbles[16], x[48], c[16], m[16], l, mask, t;
+    uint8_t rows[16 * 16];
+
+    for(int k = 0; k < 16; k++)
+    {
+        tables[k] = _mm_loadu_si128((const __m128i *)(sub_table + 16 * k));
+        nibbles[k] = _mm_set1_epi8(k << 4);
+    }
+
+    md2_transpose(rows, blocks, 16);
+    for(int i = 0; i < 16; i++)
+        m[i] = _mm_loadu_si128((const __m128i *)(rows + 16 * i));
+    for(int i = 0; i < 48; i++)
+        x[i] = _mm_loadu_si128((const __m128i *)(state + 16 * (MD2_LANE_MDBUFFER + i)));
+    for(int i = 0; i < 16; i++)
+        c[i] = _mm_loadu_si128((const __m128i *)(state + 16 * (MD2_LANE_CHECKSUM + i)));
+    l = _mm_loadu_si128((const __m128i *)(state + 16 * MD2_LANE_L));
+    mask = _mm_loadu_si128((const __m128i *)update);
+
+    // md2_update_checksum
+    for(int i = 0; i < 16; i++)
+    {
+        c[i] = _mm_xor_si128(c[i], _mm_and_si128(md2_sub_ssse3(_mm_xor_si128(m[i], l), tables, nibbles), mask));
+        l = c[i];
+    }
+
+    // md2_update_mdbuffer
+    for(int i = 0; i < 16; i++)
+    {
+        x[16 + i] = m[i];
+        x[32 + i] = _mm_xor_si128(m[i], x[i]);
+    }
+
+    t = _mm_setzero_si128();
+    for(int i = 0; i < 18; i++)
+    {
+        for(int j = 0; j < 48; j++)
+        {
+            t = _mm_xor_si128(x[j], md2_sub_ssse3(t, tables, nibbles));
+            x[j] = t;
+        }
+        t = _mm_add_epi8(t, _mm_set1_epi8(i));
+    }
+
+    for(int i = 0; i < 48; i++)
+        _mm_storeu_si128((__m128i *)(state + 16 * (MD2_LANE_MDBUFFER + i)), x[i]);
+    for(int i = 0; i < 16; i++)
+        _mm_storeu_si128((__m128i *)(state + 16 * (MD2_LANE_CHECKSUM + i)), c[i]);
+    _mm_storeu_si128((__m128i *)(state + 16 * MD2_LANE_L), l);
+}
+
+// Same lookup as md2_sub_ssse3 on 32 lanes, vpshufb works on each 128 bit half
+// so the tables are simply broadcast to both halves
+__attribute__((always_inline, target("avx2")))
+static inline __m256i md2_sub_avx2(__m256i x, const __m256i *tables, const __m256i *nibbles)
+{
+    __m256i r[16];
+    for(int k = 0; k < 16; k++)
+    {
+        __m256i idx = _mm256_adds_epu8(_mm256_xor_si256(x, nibbles[k]), nibbles[7]);
+        r[k] = _mm256_shuffle_epi8(tables[k], idx);
+    }
+    for(int n = 8; n > 0; n /= 2)
+        for(int k = 0; k < n; k++)
+            r[k] = _mm256_or_si256(r[k], r[k + n]);
+    return r[0];
+}
+
+// Run one block through 32 lanes with AVX2
+__attribute__((target("avx2")))
+static void md2_lanes_avx2(uint8_t *state, const uint8_t **blocks, const uint8_t *update)
+{
+    __m256i tables[16], nibbles[16], x[48], c[16], m[16], l, mask, t;
+    uint8_t rows[16 * 32];
+
+    for(int k = 0; k < 16; k++)
+    {
+        tables[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(sub_table + 16 * k)));
+        nibbles[k] = _mm256_set1_epi8(k << 4);
+    }
+
+    md2_transpose(rows, blocks, 32);
+    for(int i = 0; i < 16; i++)
+        m[i] = _mm256_loadu_si256((const __m256i *)(rows + 32 * i));
+    for(int i = 0; i < 48; i++)
+        x[i] = _mm256_loadu_si256((const __m256i *)(state + 32 * (MD2_LANE_MDBUFFER + i)));
+    for(int i = 0; i < 16; i++)
+        c[i] = _mm256_loadu_si256((const __m256i *)(state + 32 * (MD2_LANE_CHECKSUM + i)));
+    l = _mm256_loadu_si256((const __m256i *)(state + 32 * MD2_LANE_L));
+    mask = _mm256_loadu_si256((const __m256i *)update);
+
+    // md2_update_checksum
+    for(int i = 0; i < 16; i++)
+    {
+        c[i] = _mm256_xor_si256(c[i], _mm256_and_si256(md2_sub_avx2(_mm256_xor_si256(m[i], l), tables, nibbles), mask));
+        l = c[i];
+    }
+
+    // md2_update_mdbuffer
+    for(int i = 0; i < 16; i++)
+    {
+        x[16 + i] = m[i];
+        x[32 + i] = _mm256_xor_si256(m[i], x[i]);
+    }
+
+    t = _mm256_setzero_si256();
+    for(int i = 0; i < 18; i++)
+    {
+        for(int j = 0; j < 48; j++)
+        {
+            t = _mm256_xor_si256(x[j], md2_sub_avx2(t, tables, nibbles));
+            x[j] = t;
+        }
+        t = _mm256_add_epi8(t, _mm256_set1_epi8(i));
+    }
+
+    for(int i = 0; i < 48; i++)
+        _mm256_storeu_si256((__m256i *)(state + 32 * (MD2_LANE_MDBUFFER + i)), x[i]);
+    for(int i = 0; i < 16; i++)
+        _mm256_storeu_si256((__m256i *)(state + 32 * (MD2_LANE_CHECKSUM + i)), c[i]);
+    _mm256_storeu_si256((__m256i *)(state + 32 * MD2_LANE_L), l);
+}
+#endif
+
+void md2_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    size_t width = 0;
+    void (*lanefunc)(uint8_t *, const uint8_t **, const uint8_t *) = NULL;
+
+#ifdef NOTCRYPTO_X86_SIMD
+    if(count > 16 && cpu_has_avx2())
+    {
+        width = 32;
+        lanefunc = md2_lanes_avx2;
+    }
+    else if(count > 1 && cpu_has_ssse3())
+    {
+        width = 16;
+        lanefunc = md2_lanes_ssse3;
+    }
+#endif
+
+    // One message at a time if we can't do better
+    if(lanefunc == NULL)
+    {
+        for(size_t i = 0; i < count; i++)
+            md2(buffers[i], lens[i], hashes[i]);
+        return;
+    }
+
+    struct md2_lane lanes[32];
+    const uint8_t *blocks[32];
+    uint8_t update[32];
+    uint8_t state[MD2_LANE_BYTES * 32];
+    size_t active = 0, next = 0;
+
+    for(size_t l = 0; l < width; l++)
+        lanes[l].hash = NULL;
+
+    for(;;)
+    {
+        // Start the next messages in the idle lanes
+        for(size_t l = 0; l < width && next < count; l++)
+        {
+            if(lanes[l].hash != NULL)
+                continue;
+            md2_lane_init(&lanes[l], buffers[next], lens[next], hashes[next]);
+            for(int i = 0; i < MD2_LANE_BYTES; i++)
+                state[i * width + l] = 0;
+            next++;
+            active++;
+        }
+        if(active == 0)
+            break;
+
+        // Message blocks, then the padded block, then the checksum which must
+        // not update the checksum itself
+        for(size_t l = 0; l < width; l++)
+        {
+            struct md2_lane *lane = &lanes[l];
+            size_t n = lane->next++;
+
+            update[l] = 0xff;
+            if(lane->hash == NULL)
+                blocks[l] = md2_zero_block;
+            else if(n < lane->blocks)
+                blocks[l] = lane->buffer + 16 * n;
+            else if(n == lane->blocks)
+                blocks[l] = lane->tail;
+            else
+            {
+                for(int i = 0; i < 16; i++)
+                    lane->checksum[i] = state[(MD2_LANE_CHECKSUM + i) * width + l];
+                blocks[l] = lane->checksum;
+                update[l] = 0;
+            }
+        }
+
+        lanefunc(state, blocks, update);
+
+        // Hand out the hashes of the lanes that are done
+        for(size_t l = 0; l < width; l++)
+        {
+            if(lanes[l].hash == NULL || lanes[l].next < lanes[l].blocks + 2)
+                continue;
+            for(int i = 0; i < 16; i++)
+                lanes[l].hash[i] = state[(MD2_LANE_MDBUFFER + i) * width + l];
+            lanes[l].hash = NULL;
+            active--;
+        }
+    }
+}
@@ -29,6 +29,8 @@
 
 #include <string.h>
 #include "md5.h"
+#include "cpu.h"
+#include "multibuffer.h"
 
 // The 4 'simple' transformation functions
 static inline uint32_t md5_func_f(uint32_t x, uint32_t y, uint32_t z)
@@ -231,3 +233,199 @@ void md5(const uint8_t *buffer, size_t len, uint8_t *hash)
     md5_update(&ctx, buffer, len);
     md5_final(&ctx, hash);
 }
+
+/* Multi buffer hashing, the lanes are driven by multibuffer.h. */
+
+#ifdef NOTCRYPTO_X86_SIMD
+// All 64 rounds of md5_update_block, ROUND(func, a, b, c, d, word, shift, constant)
+# define MD5_ROUND_LIST(ROUND, F, G, H, I)                     \
+    ROUND(F, a, b, c, d,  0,  7, 0xd76aa478);                  \
+    ROUND(F, d, a, b, c,  1, 12, 0xe8c7b756);                  \
+    ROUND(F, c, d, a, b,  2, 17, 0x242070db);                  \
+    ROUND(F, b, c, d, a,  3, 22, 0xc1bdceee);                  \
+    ROUND(F, a, b, c, d,  4,  7, 0xf57c0faf);                  \
+    ROUND(F, d, a, b, c,  5, 12, 0x4787c62a);                  \
+    ROUND(F, c, d, a, b,  6, 17, 0xa8304613);                  \
+    ROUND(F, b, c, d, a,  7, 22, 0xfd469501);                  \
+    ROUND(F, a, b, c, d,  8,  7, 0x698098d8);                  \
+    ROUND(F, d, a, b, c,  9, 12, 0x8b44f7af);                  \
+    ROUND(F, c, d, a, b, 10, 17, 0xffff5bb1);                  \
+    ROUND(F, b, c, d, a, 11, 22, 0x895cd7be);                  \
+    ROUND(F, a, b, c, d, 12,  7, 0x6b901122);                  \
+    ROUND(F, d, a, b, c, 13, 12, 0xfd987193);                  \
+    ROUND(F, c, d, a, b, 14, 17, 0xa679438e);                  \
+    ROUND(F, b, c, d, a, 15, 22, 0x49b40821);                  \
+    ROUND(G, a, b, c, d,  1,  5, 0xf61e2562);                  \
+    ROUND(G, d, a, b, c,  6,  9, 0xc040b340);                  \
+    ROUND(G, c, d, a, b, 11, 14, 0x265e5a51);                  \
+    ROUND(G, b, c, d, a,  0, 20, 0xe9b6c7aa);                  \
+    ROUND(G, a, b, c, d,  5,  5, 0xd62f105d);                  \
+    ROUND(G, d, a, b, c, 10,  9, 0x02441453);                  \
+    ROUND(G, c, d, a, b, 15, 14, 0xd8a1e681);                  \
+    ROUND(G, b, c, d, a,  4, 20, 0xe7d3fbc8);                  \
+    ROUND(G, a, b, c, d,  9,  5, 0x21e1cde6);                  \
+    ROUND(G, d, a, b, c, 14,  9, 0xc33707d6);                  \
+    ROUND(G, c, d, a, b,  3, 14, 0xf4d50d87);                  \
+    ROUND(G, b, c, d, a,  8, 20, 0x455a14ed);                  \
+    ROUND(G, a, b, c, d, 13,  5, 0xa9e3e905);                  \
+    ROUND(G, d, a, b, c,  2,  9, 0xfcefa3f8);                  \
+    ROUND(G, c, d, a, b,  7, 14, 0x676f02d9);                  \
+    ROUND(G, b, c, d, a, 12, 20, 0x8d2a4c8a);                  \
+    ROUND(H, a, b, c, d,  5,  4, 0xfffa3942);                  \
+    ROUND(H, d, a, b, c,  8, 11, 0x8771f681);                  \
+    ROUND(H, c, d, a, b, 11, 16, 0x6d9d6122);                  \
+    ROUND(H, b, c, d, a, 14, 23, 0xfde5380c);                  \
+    ROUND(H, a, b, c, d,  1,  4, 0xa4beea44);                  \
+    ROUND(H, d, a, b, c,  4, 11, 0x4bdecfa9);                  \
+    ROUND(H, c, d, a, b,  7, 16, 0xf6bb4b60);                  \
+    ROUND(H, b, c, d, a, 10, 23, 0xbebfbc70);                  \
+    ROUND(H, a, b, c, d, 13,  4, 0x289b7ec6);                  \
+    ROUND(H, d, a, b, c,  0, 11, 0xeaa127fa);                  \
+    ROUND(H, c, d, a, b,  3, 16, 0xd4ef3085);                  \
+    ROUND(H, b, c, d, a,  6, 23, 0x04881d05);                  \
+    ROUND(H, a, b, c, d,  9,  4, 0xd9d4d039);                  \
+    ROUND(H, d, a, b, c, 12, 11, 0xe6db99e5);                  \
+    ROUND(H, c, d, a, b, 15, 16, 0x1fa27cf8);                  \
+    ROUND(H, b, c, d, a,  2, 23, 0xc4ac5665);                  \
+    ROUND(I, a, b, c, d,  0,  6, 0xf4292244);                  \
+    ROUND(I, d, a, b, c,  7, 10, 0x432aff97);                  \
+    ROUND(I, c, d, a, b, 14, 15, 0xab9423a7);                  \
+    ROUND(I, b, c, d, a,  5, 21, 0xfc93a039);                  \
+    ROUND(I, a, b, c, d, 12,  6, 0x655b59c3);                  \
+    ROUND(I, d, a, b, c,  3, 10, 0x8f0ccc92);                  \
+    ROUND(I, c, d, a, b, 10, 15, 0xffeff47d);                  \
+    ROUND(I, b, c, d, a,  1, 21, 0x85845dd1);                  \
+    ROUND(I, a, b, c, d,  8,  6, 0x6fa87e4f);                  \
+    ROUND(I, d, a, b, c, 15, 10, 0xfe2ce6e0);                  \
+    ROUND(I, c, d, a, b,  6, 15, 0xa3014314);                  \
+    ROUND(I, b, c, d, a, 13, 21, 0x4e0811a1);                  \
+    ROUND(I, a, b, c, d,  4,  6, 0xf7537e82);                  \
+    ROUND(I, d, a, b, c, 11, 10, 0xbd3af235);                  \
+    ROUND(I, c, d, a, b,  2, 15, 0x2ad7d2bb);                  \
+    ROUND(I, b, c, d, a,  9, 21, 0xeb86d391)
+
+# define MD5_F_AVX2(x, y, z) _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+# define MD5_G_AVX2(x, y, z) _mm256_xor_si256(y, _mm256_and_si256(z, _mm256_xor_si256(x, y)))
+# define MD5_H_AVX2(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+# define MD5_I_AVX2(x, y, z) _mm256_xor_si256(y, _mm256_or_si256(x, _mm256_xor_si256(z, ones)))
+
+# define MD5_ROUND_AVX2(func, a, b, c, d, i, s, k)                                             \
+    do {                                                                                    \
+        __m256i sum = _mm256_add_epi32(_mm256_add_epi32(a, func(b, c, d)),                  \
+                                       _mm256_add_epi32(m[i], _mm256_set1_epi32(k)));       \
+        a = _mm256_add_epi32(b, _mm256_or_si256(_mm256_slli_epi32(sum, s),                  \
+                                                _mm256_srli_epi32(sum, 32 - (s))));         \
+    } while(0)
+
+// Run one block through 8 lanes with AVX2
+__attribute__((target("avx2")))
+static void md5_lanes_avx2(void *vstate, const uint8_t **blocks)
+{
+    uint32_t *state = vstate;
+    const __m256i ones = _mm256_set1_epi32(-1);
+    __m256i m[16];
+
+    // Turn the 8 blocks into 16 vectors of message words, MD5 is little endian
+    // so there is no byte swapping
+    for(int half = 0; half < 2; half++)
+    {
+        for(int i = 0; i < 8; i++)
+            m[8 * half + i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + 32 * half));
+        cpu_transpose_8x32(&m[8 * half]);
+    }
+
+    __m256i a = _mm256_loadu_si256((const __m256i *)&state[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i *)&state[8]);
+    __m256i c = _mm256_loadu_si256((const __m256i *)&state[16]);
+    __m256i d = _mm256_loadu_si256((const __m256i *)&state[24]);
+
+    MD5_ROUND_LIST(MD5_ROUND_AVX2, MD5_F_AVX2, MD5_G_AVX2, MD5_H_AVX2, MD5_I_AVX2);
+
+    // save the state
+    _mm256_storeu_si256((__m256i *)&state[0],  _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[0]), a));
+    _mm256_storeu_si256((__m256i *)&state[8],  _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[8]), b));
+    _mm256_storeu_si256((__m256i *)&state[16], _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[16]), c));
+    _mm256_storeu_si256((__m256i *)&state[24], _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[24]), d));
+}
+
+// The four round functions are single vpternlogd instructions
+# define MD5_F_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xCA)
+# define MD5_G_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xE4)
+# define MD5_H_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+# define MD5_I_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x39)
+
+# define MD5_ROUND_AVX512(func, a, b, c, d, i, s, k)                                           \
+    do {                                                                                    \
+        __m512i sum = _mm512_add_epi32(_mm512_add_epi32(a, func(b, c, d)),                  \
+                                       _mm512_add_epi32(m[i], _mm512_set1_epi32(k)));       \
+        a = _mm512_add_epi32(b, _mm512_rol_epi32(sum, s));                                  \
+    } while(0)
+
+// Run one block through 16 lanes with AVX-512
+__attribute__((target("avx512f,avx2")))
+static void md5_lanes_avx512(void *vstate, const uint8_t **blocks)
+{
+    uint32_t *state = vstate;
+    __m512i m[16];
+
+    // Transpose lanes 0-7 and 8-15 separately and glue them together
+    for(int half = 0; half < 2; half++)
+    {
+        __m256i lo[8], hi[8];
+        for(int i = 0; i < 8; i++)
+        {
+            lo[i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + 32 * half));
+            hi[i] = _mm256_loadu_si256((const __m256i *)(blocks[i + 8] + 32 * half));
+        }
+        cpu_transpose_8x32(lo);
+        cpu_transpose_8x32(hi);
+        for(int i = 0; i < 8; i++)
+            m[8 * half + i] = _mm512_inserti64x4(_mm512_castsi256_si512(lo[i]), hi[i], 1);
+    }
+
+    __m512i a = _mm512_loadu_si512(&state[0]);
+    __m512i b = _mm512_loadu_si512(&state[16]);
+    __m512i c = _mm512_loadu_si512(&state[32]);
+    __m512i d = _mm512_loadu_si512(&state[48]);
+
+    MD5_ROUND_LIST(MD5_ROUND_AVX512, MD5_F_AVX512, MD5_G_AVX512, MD5_H_AVX512, MD5_I_AVX512);
+
+    // save the state
+    _mm512_storeu_si512(&state[0],  _mm512_add_epi32(_mm512_loadu_si512(&state[0]), a));
+    _mm512_storeu_si512(&state[16], _mm512_add_epi32(_mm512_loadu_si512(&state[16]), b));
+    _mm512_storeu_si512(&state[32], _mm512_add_epi32(_mm512_loadu_si512(&state[32]), c));
+    _mm512_storeu_si512(&state[48], _mm512_add_epi32(_mm512_loadu_si512(&state[48]), d));
+}
+#endif
+
+void md5_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    size_t width = 0;
+    multibuffer_lanefunc_t lanefunc = NULL;
+
+#ifdef NOTCRYPTO_X86_SIMD
+    if(count > 8 && cpu_has_avx512())
+    {
+        width = 16;
+        lanefunc = md5_lanes_avx512;
+    }
+    else if(count > 1 && cpu_has_avx2())
+    {
+        width = 8;
+        lanefunc = md5_lanes_avx2;
+    }
+#endif
+
+    // One message at a time if we can't do better
+    if(lanefunc == NULL)
+    {
+        for(size_t i = 0; i < count; i++)
+            md5(buffers[i], lens[i], hashes[i]);
+        return;
+    }
+
+    struct md5_context ctx;
+    md5_init(&ctx);
+    struct multibuffer_hash mb = {64, 8, 0, 4, 4, 16, ctx.state, {0, 0}};
+    multibuffer_run(&mb, width, lanefunc, buffers, lens, hashes, count);
+}
@@ -29,6 +29,8 @@
 #include <stdio.h>
 #include <string.h>
 #include "sha1.h"
+#include "cpu.h"
+#include "multibuffer.h"
 
 // The transformation function building block, correct behavior chosen based
 // on the iteration count
@@ -128,6 +130,169 @@ static void sha1_update_block(struct sha1_context *ctx, const uint8_t *buffer)
     a = b = c = d = e = 0;
 }
 
+#ifdef NOTCRYPTO_X86_SIMD
+// One group of 4 rounds for the SHA-NI block function below. sha1rnds4 picks
+// the round function and constant from its immediate, sha1nexte derives e for
+// the group of rounds and sha1msg1/sha1msg2 expand the schedule as we go
+# define SHA1_SHANI_GROUP(i, func)                                                       \
+    do {                                                                                \
+        if((i) == 0)                                                                    \
+            e[0] = _mm_add_epi32(e[0], msg[0]);                                         \
+        else                                                                            \
+            e[(i) % 2] = _mm_sha1nexte_epu32(e[(i) % 2], msg[(i) % 4]);                 \
+        e[((i) + 1) % 2] = abcd;                                                        \
+        abcd = _mm_sha1rnds4_epu32(abcd, e[(i) % 2], func);                             \
+                                                                                        \
+        if((i) >= 1 && (i) <= 16)                                                       \
+            msg[((i) + 3) % 4] = _mm_sha1msg1_epu32(msg[((i) + 3) % 4], msg[(i) % 4]);  \
+        if((i) >= 2 && (i) <= 17)                                                       \
+            msg[((i) + 2) % 4] = _mm_xor_si128(msg[((i) + 2) % 4], msg[(i) % 4]);       \
+        if((i) >= 3 && (i) <= 18)                                                       \
+            msg[((i) + 1) % 4] = _mm_sha1msg2_epu32(msg[((i) + 1) % 4], msg[(i) % 4]);  \
+    } while(0)
+
+// SHA-NI version of sha1_update_block
+__attribute__((target("sha,sse4.1")))
+static void sha1_update_blocks_shani(uint32_t *state, const uint8_t *buffer, size_t blocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e_save, e[2], msg[4];
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+    e[0] = _mm_set_epi32(state[4], 0, 0, 0);
+
+    for(; blocks > 0; blocks--, buffer += 64)
+    {
+        abcd_save = abcd;
+        e_save = e[0];
+
+        for(int i = 0; i < 4; i++)
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buffer + 16 * i)), bswap);
+
+        // 20 rounds for each of the 4 round functions
+        for(int i = 0; i < 5; i++)
+            SHA1_SHANI_GROUP(i, 0);
+        for(int i = 5; i < 10; i++)
+            SHA1_SHANI_GROUP(i, 1);
+        for(int i = 10; i < 15; i++)
+            SHA1_SHANI_GROUP(i, 2);
+        for(int i = 15; i < 20; i++)
+            SHA1_SHANI_GROUP(i, 3);
+
+        e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e[0], 3);
+}
+
+// One scalar round with the round constant already added to the schedule word
+# define SHA1_ROUND_WK(f, wk)                                                  \
+    do {                                                                    \
+        temp = sha1_rot(a, 5) + (f) + e + (wk);                             \
+        e = d;                                                              \
+        d = c;                                                              \
+        c = sha1_rot(b, 30);                                                \
+        b = a;                                                              \
+        a = temp;                                                           \
+    } while(0)
+
+// SSSE3 version of sha1_update_block. The schedule is expanded four words at a
+// time, W[t + 3] depends on W[t] so the top word is patched up after the
+// vector rotate. The round constants are added to the schedule before the
+// rounds, which are then split into one loop per round function.
+__attribute__((always_inline, target("ssse3")))
+static inline void sha1_update_blocks_vec(uint32_t *state, const uint8_t *buffer, size_t blocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    const uint32_t k[4] = {0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6};
+    uint32_t wk[80];
+    __m128i w[20];
+    uint32_t a, b, c, d, e, temp;
+
+    for(; blocks > 0; blocks--, buffer += 64)
+    {
+        for(int i = 0; i < 4; i++)
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buffer + 16 * i)), bswap);
+
+        for(int i = 4; i < 20; i++)
+        {
+            // W[t-16] ^ W[t-14] ^ W[t-8] ^ (W[t-3], W[t-2], W[t-1], 0)
+            __m128i x = _mm_xor_si128(_mm_xor_si128(w[i - 4], _mm_alignr_epi8(w[i - 3], w[i - 4], 8)),
+                                      _mm_xor_si128(w[i - 2], _mm_srli_si128(w[i - 1], 4)));
+            __m128i r = _mm_or_si128(_mm_slli_epi32(x, 1), _mm_srli_epi32(x, 31));
+            // The missing W[t] term of the top word, rotated into place
+            __m128i fix = _mm_slli_si128(r, 12);
+            w[i] = _mm_xor_si128(r, _mm_or_si128(_mm_slli_epi32(fix, 1), _mm_srli_epi32(fix, 31)));
+        }
+
+        for(int i = 0; i < 20; i++)
+            _mm_storeu_si128((__m128i *)&wk[4 * i], _mm_add_epi32(w[i], _mm_set1_epi32(k[i / 5])));
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+
+        for(int t = 0; t < 20; t++)
+            SHA1_ROUND_WK(d ^ (b & (c ^ d)), wk[t]);
+        for(int t = 20; t < 40; t++)
+            SHA1_ROUND_WK(b ^ c ^ d, wk[t]);
+        for(int t = 40; t < 60; t++)
+            SHA1_ROUND_WK((b & c) | (d & (b | c)), wk[t]);
+        for(int t = 60; t < 80; t++)
+            SHA1_ROUND_WK(b ^ c ^ d, wk[t]);
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+
+    memset(wk, 0, sizeof(wk));
+}
+
+__attribute__((target("ssse3")))
+static void sha1_update_blocks_ssse3(uint32_t *state, const uint8_t *buffer, size_t blocks)
+{
+    sha1_update_blocks_vec(state, buffer, blocks);
+}
+
+// Same kernel with VEX encoded instructions
+__attribute__((target("avx")))
+static void sha1_update_blocks_avx(uint32_t *state, const uint8_t *buffer, size_t blocks)
+{
+    sha1_update_blocks_vec(state, buffer, blocks);
+}
+#endif
+
+// Feed a run of 64 byte blocks into the fastest block function this CPU has
+static void sha1_update_blocks(struct sha1_context *ctx, const uint8_t *buffer, size_t blocks)
+{
+#ifdef NOTCRYPTO_X86_SIMD
+    if(cpu_has_shani())
+    {
+        sha1_update_blocks_shani(ctx->state, buffer, blocks);
+        return;
+    }
+    if(cpu_has_avx())
+    {
+        sha1_update_blocks_avx(ctx->state, buffer, blocks);
+        return;
+    }
+    if(cpu_has_ssse3())
+    {
+        sha1_update_blocks_ssse3(ctx->state, buffer, blocks);
+        return;
+    }
+#endif
+    for(; blocks > 0; blocks--, buffer += 64)
+        sha1_update_block(ctx, buffer);
+}
+
 void sha1_update(struct sha1_context *ctx, const uint8_t *buffer, size_t len)
 {
     ctx->len += len;
@@ -144,17 +309,17 @@ void sha1_update(struct sha1_context *ctx, const uint8_t *buffer, size_t len)
 
         if(ctx->bufused == 64)
         {
-            sha1_update_block(ctx, ctx->buffer);
+            sha1_update_blocks(ctx, ctx->buffer, 1);
             ctx->bufused = 0;
         }
     }
 
     // Feed 64 byte blocks into the update function
-    while(len >= 64)
+    if(len >= 64)
     {
-        sha1_update_block(ctx, buffer);
-        len    -= 64;
-        buffer += 64;
+        sha1_update_blocks(ctx, buffer, len / 64);
+        buffer += len & ~(size_t)63;
+        len    &= 63;
     }
 
     // And save any overflow bytes for next update
@@ -192,3 +357,199 @@ void sha1(const uint8_t *buffer, size_t len, uint8_t *hash)
     sha1_update(&ctx, buffer, len);
     sha1_final(&ctx, hash);
 }
+
+/* Multi buffer hashing, the lanes are driven by multibuffer.h. */
+
+#ifdef NOTCRYPTO_X86_SIMD
+# define SHA1_ROT_AVX2(x, s) _mm256_or_si256(_mm256_slli_epi32(x, s), _mm256_srli_epi32(x, 32 - (s)))
+# define SHA1_XOR3_AVX2(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+# define SHA1_CH_AVX2(x, y, z) _mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+# define SHA1_MAJ_AVX2(x, y, z) _mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y)))
+
+// Expand the schedule in place, w_buf only holds the last 16 words
+# define SHA1_SCHEDULE_AVX2(t)                                                                  \
+    do {                                                                                    \
+        if((t) >= 16)                                                                       \
+            w_buf[(t) % 16] = SHA1_ROT_AVX2(_mm256_xor_si256(SHA1_XOR3_AVX2(w_buf[((t) - 3) % 16],  \
+                                                w_buf[((t) - 8) % 16], w_buf[((t) - 14) % 16]), \
+                                                w_buf[(t) % 16]), 1);                           \
+    } while(0)
+
+# define SHA1_ROUND_AVX2(t, f, k)                                                               \
+    do {                                                                                    \
+        SHA1_SCHEDULE_AVX2(t);                                                              \
+        temp = _mm256_add_epi32(_mm256_add_epi32(SHA1_ROT_AVX2(a, 5), f),                   \
+                                _mm256_add_epi32(_mm256_add_epi32(e, w_buf[(t) % 16]), k)); \
+        e = d;                                                                              \
+        d = c;                                                                              \
+        c = SHA1_ROT_AVX2(b, 30);                                                           \
+        b = a;                                                                              \
+        a = temp;                                                                           \
+    } while(0)
+
+// Run one block through 8 lanes with AVX2, same rounds as sha1_update_block
+// with one loop per round function
+__attribute__((target("avx2")))
+static void sha1_lanes_avx2(void *vstate, const uint8_t **blocks)
+{
+    uint32_t *state = vstate;
+    const __m256i bswap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                            0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m256i w_buf[16];
+    __m256i a, b, c, d, e, temp, k;
+
+    // Turn the 8 blocks into 16 vectors of message words
+    for(int half = 0; half < 2; half++)
+    {
+        for(int i = 0; i < 8; i++)
+            w_buf[8 * half + i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + 32 * half));
+        cpu_transpose_8x32(&w_buf[8 * half]);
+    }
+    for(int i = 0; i < 16; i++)
+        w_buf[i] = _mm256_shuffle_epi8(w_buf[i], bswap);
+
+    a = _mm256_loadu_si256((const __m256i *)&state[0]);
+    b = _mm256_loadu_si256((const __m256i *)&state[8]);
+    c = _mm256_loadu_si256((const __m256i *)&state[16]);
+    d = _mm256_loadu_si256((const __m256i *)&state[24]);
+    e = _mm256_loadu_si256((const __m256i *)&state[32]);
+
+    k = _mm256_set1_epi32(0x5A827999);
+    for(int t = 0; t < 20; t++)
+        SHA1_ROUND_AVX2(t, SHA1_CH_AVX2(b, c, d), k);
+    k = _mm256_set1_epi32(0x6ED9EBA1);
+    for(int t = 20; t < 40; t++)
+        SHA1_ROUND_AVX2(t, SHA1_XOR3_AVX2(b, c, d), k);
+    k = _mm256_set1_epi32(0x8F1BBCDC);
+    for(int t = 40; t < 60; t++)
+        SHA1_ROUND_AVX2(t, SHA1_MAJ_AVX2(b, c, d), k);
+    k = _mm256_set1_epi32(0xCA62C1D6);
+    for(int t = 60; t < 80; t++)
+        SHA1_ROUND_AVX2(t, SHA1_XOR3_AVX2(b, c, d), k);
+
+    // save the state
+    _mm256_storeu_si256((__m256i *)&state[0],  _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[0]), a));
+    _mm256_storeu_si256((__m256i *)&state[8],  _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[8]), b));
+    _mm256_storeu_si256((__m256i *)&state[16], _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[16]), c));
+    _mm256_storeu_si256((__m256i *)&state[24], _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[24]), d));
+    _mm256_storeu_si256((__m256i *)&state[32], _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[32]), e));
+}
+
+// AVX-512 has a real rotate (vprold) and vpternlogd for the round functions
+# define SHA1_ROT_AVX512(x, s) _mm512_rol_epi32(x, s)
+# define SHA1_XOR3_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+# define SHA1_CH_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xCA)
+# define SHA1_MAJ_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xE8)
+
+# define SHA1_ROUND_AVX512(t, f, k)                                                             \
+    do {                                                                                    \
+        if((t) >= 16)                                                                       \
+            w_buf[(t) % 16] = SHA1_ROT_AVX512(_mm512_xor_si512(SHA1_XOR3_AVX512(w_buf[((t) - 3) % 16], \
+                                                w_buf[((t) - 8) % 16], w_buf[((t) - 14) % 16]), \
+                                                w_buf[(t) % 16]), 1);                           \
+        temp = _mm512_add_epi32(_mm512_add_epi32(SHA1_ROT_AVX512(a, 5), f),                 \
+                                _mm512_add_epi32(_mm512_add_epi32(e, w_buf[(t) % 16]), k)); \
+        e = d;                                                                              \
+        d = c;                                                                              \
+        c = SHA1_ROT_AVX512(b, 30);                                                         \
+        b = a;                                                                              \
+        a = temp;                                                                           \
+    } while(0)
+
+// Run one block through 16 lanes with AVX-512
+__attribute__((target("avx512f,avx2")))
+static void sha1_lanes_avx512(void *vstate, const uint8_t **blocks)
+{
+    uint32_t *state = vstate;
+    const __m256i bswap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                            0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m512i w_buf[16];
+    __m512i a, b, c, d, e, temp, k;
+
+    // Transpose lanes 0-7 and 8-15 separately and glue them together
+    for(int half = 0; half < 2; half++)
+    {
+        __m256i lo[8], hi[8];
+        for(int i = 0; i < 8; i++)
+        {
+            lo[i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + 32 * half));
+            hi[i] = _mm256_loadu_si256((const __m256i *)(blocks[i + 8] + 32 * half));
+        }
+        cpu_transpose_8x32(lo);
+        cpu_transpose_8x32(hi);
+        for(int i = 0; i < 8; i++)
+            w_buf[8 * half + i] = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_shuffle_epi8(lo[i], bswap)),
+                                                     _mm256_shuffle_epi8(hi[i], bswap), 1);
+    }
+
+    a = _mm512_loadu_si512(&state[0]);
+    b = _mm512_loadu_si512(&state[16]);
+    c = _mm512_loadu_si512(&state[32]);
+    d = _mm512_loadu_si512(&state[48]);
+    e = _mm512_loadu_si512(&state[64]);
+
+    k = _mm512_set1_epi32(0x5A827999);
+    for(int t = 0; t < 20; t++)
+        SHA1_ROUND_AVX512(t, SHA1_CH_AVX512(b, c, d), k);
+    k = _mm512_set1_epi32(0x6ED9EBA1);
+    for(int t = 20; t < 40; t++)
+        SHA1_ROUND_AVX512(t, SHA1_XOR3_AVX512(b, c, d), k);
+    k = _mm512_set1_epi32(0x8F1BBCDC);
+    for(int t = 40; t < 60; t++)
+        SHA1_ROUND_AVX512(t, SHA1_MAJ_AVX512(b, c, d), k);
+    k = _mm512_set1_epi32(0xCA62C1D6);
+    for(int t = 60; t < 80; t++)
+        SHA1_ROUND_AVX512(t, SHA1_XOR3_AVX512(b, c, d), k);
+
+    // save the state
+    _mm512_storeu_si512(&state[0],  _mm512_add_epi32(_mm512_loadu_si512(&state[0]), a));
+    _mm512_storeu_si512(&state[16], _mm512_add_epi32(_mm512_loadu_si512(&state[16]), b));
+    _mm512_storeu_si512(&state[32], _mm512_add_epi32(_mm512_loadu_si512(&state[32]), c));
+    _mm512_storeu_si512(&state[48], _mm512_add_epi32(_mm512_loadu_si512(&state[48]), d));
+    _mm512_storeu_si512(&state[64], _mm512_add_epi32(_mm512_loadu_si512(&state[64]), e));
+}
+#endif
+
+// Hash count messages starting from the state in ctx, which must not have any
+// buffered bytes for the lanes to be used
+void sha1_xN_ctx(const struct sha1_context *ctx, const uint8_t *buffers[], const size_t lens[],
+                 uint8_t *hashes[], size_t count)
+{
+    size_t width = 0;
+    multibuffer_lanefunc_t lanefunc = NULL;
+
+#ifdef NOTCRYPTO_X86_SIMD
+    if(count > 8 && cpu_has_avx512())
+    {
+        width = 16;
+        lanefunc = sha1_lanes_avx512;
+    }
+    else if(count > 1 && cpu_has_avx2())
+    {
+        width = 8;
+        lanefunc = sha1_lanes_avx2;
+    }
+#endif
+
+    // One message at a time if we can't do better
+    if(lanefunc == NULL || ctx->bufused != 0)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            struct sha1_context lctx = *ctx;
+            sha1_update(&lctx, buffers[i], lens[i]);
+            sha1_final(&lctx, hashes[i]);
+        }
+        return;
+    }
+
+    struct multibuffer_hash mb = {64, 8, 1, 4, 5, 20, ctx->state, {ctx->len, 0}};
+    multibuffer_run(&mb, width, lanefunc, buffers, lens, hashes, count);
+}
+
+void sha1_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    struct sha1_context ctx;
+    sha1_init(&ctx);
+    sha1_xN_ctx(&ctx, buffers, lens, hashes, count);
+}
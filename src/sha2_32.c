@@ -31,6 +31,8 @@
 
 #include <string.h>
 #include "sha2.h"
+#include "cpu.h"
+#include "multibuffer.h"
 
 inline static uint32_t sha2_rot(uint32_t x, int bits)
 {
@@ -167,6 +169,69 @@ static void sha2_update_block(struct sha2_context *ctx, const uint8_t *buffer)
         ctx->ctx_union.b32.state[i] += lstate[i];
 }
 
+#ifdef NOTCRYPTO_X86_SIMD
+// SHA-NI version of sha2_update_block. The state is kept in the ABEF/CDGH
+// layout sha256rnds2 expects for the whole run of blocks, every sha256rnds2
+// does 2 rounds and sha256msg1/sha256msg2 expand the schedule 4 words at a time
+__attribute__((target("sha,sse4.1")))
+static void sha2_update_blocks_shani(uint32_t *state, const uint8_t *buffer, size_t blocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, msg[4], tmp, abef, cdgh;
+
+    tmp    = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);  // CDAB
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);  // EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);                                       // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                    // CDGH
+
+    for(; blocks > 0; blocks--, buffer += 64)
+    {
+        abef = state0;
+        cdgh = state1;
+
+        for(int i = 0; i < 4; i++)
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buffer + 16 * i)), bswap);
+
+        // Run over 16 groups of 4 rounds, expanding the next 4 words as we go
+        for(int i = 0; i < 16; i++)
+        {
+            if(i >= 4)
+            {
+                tmp = _mm_sha256msg1_epu32(msg[i % 4], msg[(i + 1) % 4]);
+                tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(msg[(i + 3) % 4], msg[(i + 2) % 4], 4));
+                msg[i % 4] = _mm_sha256msg2_epu32(tmp, msg[(i + 3) % 4]);
+            }
+
+            tmp = _mm_add_epi32(msg[i % 4], _mm_loadu_si128((const __m128i *)&sha2_const[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, tmp);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(tmp, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp    = _mm_shuffle_epi32(state0, 0x1B);       // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);       // DCHG
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));    // DCBA
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));       // HGFE
+}
+#endif
+
+// Feed a run of 64 byte blocks into the fastest block function this CPU has
+static void sha2_update_blocks(struct sha2_context *ctx, const uint8_t *buffer, size_t blocks)
+{
+#ifdef NOTCRYPTO_X86_SIMD
+    if(cpu_has_shani())
+    {
+        sha2_update_blocks_shani(ctx->ctx_union.b32.state, buffer, blocks);
+        return;
+    }
+#endif
+    for(; blocks > 0; blocks--, buffer += 64)
+        sha2_update_block(ctx, buffer);
+}
+
 void sha2_256_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len)
 {
     ctx->ctx_union.b32.len += len;
@@ -183,17 +248,17 @@ void sha2_256_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len
 
         if(ctx->ctx_union.b32.bufused == 64)
         {
-            sha2_update_block(ctx, ctx->ctx_union.b32.buffer);
+            sha2_update_blocks(ctx, ctx->ctx_union.b32.buffer, 1);
             ctx->ctx_union.b32.bufused = 0;
         }
     }
 
     // Feed 64 byte blocks into the update function
-    while(len >= 64)
+    if(len >= 64)
     {
-        sha2_update_block(ctx, buffer);
-        len    -= 64;
-        buffer += 64;
+        sha2_update_blocks(ctx, buffer, len / 64);
+        buffer += len & ~(size_t)63;
+        len    &= 63;
     }
 
     // And save any overflow bytes for next update
@@ -265,3 +330,197 @@ void sha2_224(const uint8_t *buffer, size_t len, uint8_t *hash)
     sha2_224_update(&ctx, buffer, len);
     sha2_224_final(&ctx, hash);
 }
+
+/* Multi buffer hashing, the lanes are driven by multibuffer.h. */
+
+#ifdef NOTCRYPTO_X86_SIMD
+# define SHA2_ROT_AVX2(x, bits) _mm256_or_si256(_mm256_srli_epi32(x, bits), _mm256_slli_epi32(x, 32 - (bits)))
+# define SHA2_XOR3_AVX2(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+
+// Run one block through 8 lanes with AVX2, same rounds as sha2_update_block
+__attribute__((target("avx2")))
+static void sha2_lanes_avx2(void *vstate, const uint8_t **blocks)
+{
+    uint32_t *state = vstate;
+    const __m256i bswap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                            0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m256i w_buf[16];
+    __m256i lstate[8];
+    __m256i temp[2];
+
+    // Turn the 8 blocks into 16 vectors of message words
+    for(int half = 0; half < 2; half++)
+    {
+        for(int i = 0; i < 8; i++)
+            w_buf[8 * half + i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + 32 * half));
+        cpu_transpose_8x32(&w_buf[8 * half]);
+    }
+    for(int i = 0; i < 16; i++)
+        w_buf[i] = _mm256_shuffle_epi8(w_buf[i], bswap);
+
+    for(int i = 0; i < 8; i++)
+        lstate[i] = _mm256_loadu_si256((const __m256i *)&state[8 * i]);
+
+    for(int i = 0; i < 64; i++)
+    {
+        // Expand the schedule in place, w_buf only holds the last 16 words
+        if(i >= 16)
+        {
+            __m256i w2 = w_buf[(i - 2) % 16], w15 = w_buf[(i - 15) % 16];
+            __m256i s1 = SHA2_XOR3_AVX2(SHA2_ROT_AVX2(w2, 17), SHA2_ROT_AVX2(w2, 19), _mm256_srli_epi32(w2, 10));
+            __m256i s0 = SHA2_XOR3_AVX2(SHA2_ROT_AVX2(w15, 7), SHA2_ROT_AVX2(w15, 18), _mm256_srli_epi32(w15, 3));
+            w_buf[i % 16] = _mm256_add_epi32(_mm256_add_epi32(w_buf[i % 16], s0),
+                                             _mm256_add_epi32(w_buf[(i - 7) % 16], s1));
+        }
+
+        __m256i e = lstate[4], a = lstate[0];
+        __m256i ch  = _mm256_xor_si256(_mm256_and_si256(e, lstate[5]), _mm256_andnot_si256(e, lstate[6]));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, lstate[1]), _mm256_and_si256(lstate[2], _mm256_or_si256(a, lstate[1])));
+        temp[0] = _mm256_add_epi32(_mm256_add_epi32(lstate[7], ch),
+                                   _mm256_add_epi32(SHA2_XOR3_AVX2(SHA2_ROT_AVX2(e, 6), SHA2_ROT_AVX2(e, 11), SHA2_ROT_AVX2(e, 25)),
+                                                    _mm256_add_epi32(_mm256_set1_epi32(sha2_const[i]), w_buf[i % 16])));
+        temp[1] = _mm256_add_epi32(SHA2_XOR3_AVX2(SHA2_ROT_AVX2(a, 2), SHA2_ROT_AVX2(a, 13), SHA2_ROT_AVX2(a, 22)), maj);
+
+        lstate[7] = lstate[6];
+        lstate[6] = lstate[5];
+        lstate[5] = lstate[4];
+        lstate[4] = _mm256_add_epi32(lstate[3], temp[0]);
+        lstate[3] = lstate[2];
+        lstate[2] = lstate[1];
+        lstate[1] = lstate[0];
+        lstate[0] = _mm256_add_epi32(temp[0], temp[1]);
+    }
+
+    for(int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)&state[8 * i],
+                            _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&state[8 * i]), lstate[i]));
+}
+
+// vpternlogd does the 3 input logic functions in a single instruction
+# define SHA2_ROT_AVX512(x, bits) _mm512_ror_epi32(x, bits)
+# define SHA2_XOR3_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+# define SHA2_CH_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xCA)
+# define SHA2_MAJ_AVX512(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xE8)
+
+// Run one block through 16 lanes with AVX-512
+__attribute__((target("avx512f,avx2")))
+static void sha2_lanes_avx512(void *vstate, const uint8_t **blocks)
+{
+    uint32_t *state = vstate;
+    const __m256i bswap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                            0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m512i w_buf[16];
+    __m512i lstate[8];
+    __m512i temp[2];
+
+    // Transpose lanes 0-7 and 8-15 separately and glue them together
+    for(int half = 0; half < 2; half++)
+    {
+        __m256i lo[8], hi[8];
+        for(int i = 0; i < 8; i++)
+        {
+            lo[i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + 32 * half));
+            hi[i] = _mm256_loadu_si256((const __m256i *)(blocks[i + 8] + 32 * half));
+        }
+        cpu_transpose_8x32(lo);
+        cpu_transpose_8x32(hi);
+        for(int i = 0; i < 8; i++)
+            w_buf[8 * half + i] = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_shuffle_epi8(lo[i], bswap)),
+                                                     _mm256_shuffle_epi8(hi[i], bswap), 1);
+    }
+
+    for(int i = 0; i < 8; i++)
+        lstate[i] = _mm512_loadu_si512(&state[16 * i]);
+
+    for(int i = 0; i < 64; i++)
+    {
+        if(i >= 16)
+        {
+            __m512i w2 = w_buf[(i - 2) % 16], w15 = w_buf[(i - 15) % 16];
+            __m512i s1 = SHA2_XOR3_AVX512(SHA2_ROT_AVX512(w2, 17), SHA2_ROT_AVX512(w2, 19), _mm512_srli_epi32(w2, 10));
+            __m512i s0 = SHA2_XOR3_AVX512(SHA2_ROT_AVX512(w15, 7), SHA2_ROT_AVX512(w15, 18), _mm512_srli_epi32(w15, 3));
+            w_buf[i % 16] = _mm512_add_epi32(_mm512_add_epi32(w_buf[i % 16], s0),
+                                             _mm512_add_epi32(w_buf[(i - 7) % 16], s1));
+        }
+
+        __m512i e = lstate[4], a = lstate[0];
+        temp[0] = _mm512_add_epi32(_mm512_add_epi32(lstate[7], SHA2_CH_AVX512(e, lstate[5], lstate[6])),
+                                   _mm512_add_epi32(SHA2_XOR3_AVX512(SHA2_ROT_AVX512(e, 6), SHA2_ROT_AVX512(e, 11), SHA2_ROT_AVX512(e, 25)),
+                                                    _mm512_add_epi32(_mm512_set1_epi32(sha2_const[i]), w_buf[i % 16])));
+        temp[1] = _mm512_add_epi32(SHA2_XOR3_AVX512(SHA2_ROT_AVX512(a, 2), SHA2_ROT_AVX512(a, 13), SHA2_ROT_AVX512(a, 22)),
+                                   SHA2_MAJ_AVX512(a, lstate[1], lstate[2]));
+
+        lstate[7] = lstate[6];
+        lstate[6] = lstate[5];
+        lstate[5] = lstate[4];
+        lstate[4] = _mm512_add_epi32(lstate[3], temp[0]);
+        lstate[3] = lstate[2];
+        lstate[2] = lstate[1];
+        lstate[1] = lstate[0];
+        lstate[0] = _mm512_add_epi32(temp[0], temp[1]);
+    }
+
+    for(int i = 0; i < 8; i++)
+        _mm512_storeu_si512(&state[16 * i], _mm512_add_epi32(_mm512_loadu_si512(&state[16 * i]), lstate[i]));
+}
+#endif
+
+// Hash count messages starting from the state in ctx, which must not have any
+// buffered bytes for the lanes to be used
+static void sha2_32_xN(const struct sha2_context *ctx, size_t hashsize, const uint8_t *buffers[],
+                       const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    size_t width = 0;
+    multibuffer_lanefunc_t lanefunc = NULL;
+
+#ifdef NOTCRYPTO_X86_SIMD
+    if(count > 8 && cpu_has_avx512())
+    {
+        width = 16;
+        lanefunc = sha2_lanes_avx512;
+    }
+    else if(count > 1 && cpu_has_avx2())
+    {
+        width = 8;
+        lanefunc = sha2_lanes_avx2;
+    }
+#endif
+
+    // One message at a time if we can't do better
+    if(lanefunc == NULL || ctx->ctx_union.b32.bufused != 0)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            struct sha2_context lctx = *ctx;
+            sha2_256_update(&lctx, buffers[i], lens[i]);
+            if(hashsize == 28)
+                sha2_224_final(&lctx, hashes[i]);
+            else
+                sha2_256_final(&lctx, hashes[i]);
+        }
+        return;
+    }
+
+    struct multibuffer_hash mb = {64, 8, 1, 4, 8, hashsize, ctx->ctx_union.b32.state, {ctx->ctx_union.b32.len, 0}};
+    multibuffer_run(&mb, width, lanefunc, buffers, lens, hashes, count);
+}
+
+void sha2_256_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    struct sha2_context ctx;
+    sha2_256_init(&ctx);
+    sha2_32_xN(&ctx, 32, buffers, lens, hashes, count);
+}
+
+void sha2_256_xN_ctx(const struct sha2_context *ctx, const uint8_t *buffers[], const size_t lens[],
+                     uint8_t *hashes[], size_t count)
+{
+    sha2_32_xN(ctx, 32, buffers, lens, hashes, count);
+}
+
+void sha2_224_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    struct sha2_context ctx;
+    sha2_224_init(&ctx);
+    sha2_32_xN(&ctx, 28, buffers, lens, hashes, count);
+}
@@ -23,14 +23,15 @@
  * http://csrc.nist.gov/publications/fips/fips180-3/fips180-3_final.pdf
  * This code is written solely to learn about one way hash functions and SHA2
  * specifically. This code should never be used in production, or anywhere else.
- * The sha384 and sha512 functions work incorrectly for messages with a size
- * larger than 2^64 bits. The code of sha2_32.c is almost exactly the same
- * except that it uses 32 bit variables for everything and implements 256 and
- * 224 bit hashes.
+ * The code of sha2_32.c is almost exactly the same except that it uses 32 bit
+ * variables for everything and implements 256 and 224 bit hashes. The
+ * truncated SHA-512/224 and SHA-512/256 hashes come from FIPS PUB 180-4.
  */
 
 #include <string.h>
 #include "sha2.h"
+#include "cpu.h"
+#include "multibuffer.h"
 
 inline static uint64_t sha2_rot(uint64_t x, int bits)
 {
@@ -134,6 +135,34 @@ void sha2_384_init(struct sha2_context *ctx)
     ctx->ctx_union.b64.state[7] = 0x47b5481dbefa4fa4;
 }
 
+void sha2_512_256_init(struct sha2_context *ctx)
+{
+    memset(ctx, 0, sizeof(struct sha2_context));
+
+    ctx->ctx_union.b64.state[0] = 0x22312194fc2bf72c;
+    ctx->ctx_union.b64.state[1] = 0x9f555fa3c84c64c2;
+    ctx->ctx_union.b64.state[2] = 0x2393b86b6f53b151;
+    ctx->ctx_union.b64.state[3] = 0x963877195940eabd;
+    ctx->ctx_union.b64.state[4] = 0x96283ee2a88effe3;
+    ctx->ctx_union.b64.state[5] = 0xbe5e1e2553863992;
+    ctx->ctx_union.b64.state[6] = 0x2b0199fc2c85b8aa;
+    ctx->ctx_union.b64.state[7] = 0x0eb72ddc81c52ca2;
+}
+
+void sha2_512_224_init(struct sha2_context *ctx)
+{
+    memset(ctx, 0, sizeof(struct sha2_context));
+
+    ctx->ctx_union.b64.state[0] = 0x8c3d37c819544da2;
+    ctx->ctx_union.b64.state[1] = 0x73e1996689dcd4d6;
+    ctx->ctx_union.b64.state[2] = 0x1dfab7ae32ff9c82;
+    ctx->ctx_union.b64.state[3] = 0x679dd514582f9fcf;
+    ctx->ctx_union.b64.state[4] = 0x0f6d2b697bd44da8;
+    ctx->ctx_union.b64.state[5] = 0x77e36f7304c48942;
+    ctx->ctx_union.b64.state[6] = 0x3f9d85a86a1d36c8;
+    ctx->ctx_union.b64.state[7] = 0x1112e6ad91d692a1;
+}
+
 static void sha2_update_block(struct sha2_context *ctx, const uint8_t *buffer)
 {
     uint64_t w_buf[80];
@@ -172,10 +201,128 @@ static void sha2_update_block(struct sha2_context *ctx, const uint8_t *buffer)
         ctx->ctx_union.b64.state[i] += lstate[i];
 }
 
+#ifdef NOTCRYPTO_X86_SIMD
+# define SHA2_ROT_AVX2(x, bits) _mm256_or_si256(_mm256_srli_epi64(x, bits), _mm256_slli_epi64(x, 64 - (bits)))
+# define SHA2_XOR3_AVX2(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+
+// Small transformation functions 5 and 6 on 4 words at once
+# define SHA2_FUNC_5_AVX2(x) SHA2_XOR3_AVX2(SHA2_ROT_AVX2(x, 1), SHA2_ROT_AVX2(x, 8), _mm256_srli_epi64(x, 7))
+# define SHA2_FUNC_6_AVX2(x) SHA2_XOR3_AVX2(SHA2_ROT_AVX2(x, 19), SHA2_ROT_AVX2(x, 61), _mm256_srli_epi64(x, 6))
+
+// One round with the roles of the state words given by the order of the
+// arguments, so 8 rounds in a row need no copying of the state
+# define SHA2_ROUND(a, b, c, d, e, f, g, h, wk)                                \
+    do {                                                                    \
+        uint64_t temp = h + sha2_func_4(e) + sha2_func_1(e, f, g) + (wk);   \
+        d += temp;                                                          \
+        h = temp + sha2_func_3(a) + sha2_func_2(a, b, c);                   \
+    } while(0)
+
+# define SHA2_ROUNDS_8(wk)                                  \
+    do {                                                    \
+        SHA2_ROUND(a, b, c, d, e, f, g, h, (wk)[0]);        \
+        SHA2_ROUND(h, a, b, c, d, e, f, g, (wk)[1]);        \
+        SHA2_ROUND(g, h, a, b, c, d, e, f, (wk)[2]);        \
+        SHA2_ROUND(f, g, h, a, b, c, d, e, (wk)[3]);        \
+        SHA2_ROUND(e, f, g, h, a, b, c, d, (wk)[4]);        \
+        SHA2_ROUND(d, e, f, g, h, a, b, c, (wk)[5]);        \
+        SHA2_ROUND(c, d, e, f, g, h, a, b, (wk)[6]);        \
+        SHA2_ROUND(b, c, d, e, f, g, h, a, (wk)[7]);        \
+    } while(0)
+
+// Expand the next 4 schedule words from the last 16 in w[0..3]. The words
+// w[t] and w[t + 1] are needed by sha2_func_6 for w[t + 2] and w[t + 3] so
+// that part is done in two halves.
+__attribute__((target("avx2")))
+static inline __m256i sha2_schedule_avx2(__m256i w0, __m256i w1, __m256i w2, __m256i w3)
+{
+    __m256i w15 = _mm256_alignr_epi8(_mm256_permute2x128_si256(w0, w1, 0x21), w0, 8);
+    __m256i w7  = _mm256_alignr_epi8(_mm256_permute2x128_si256(w2, w3, 0x21), w2, 8);
+    __m256i sum = _mm256_add_epi64(_mm256_add_epi64(w0, w7), SHA2_FUNC_5_AVX2(w15));
+    __m256i low, high;
+
+    low  = _mm256_permute2x128_si256(w3, w3, 0x11);
+    low  = _mm256_add_epi64(sum, SHA2_FUNC_6_AVX2(low));
+    high = _mm256_permute2x128_si256(low, low, 0x00);
+    high = _mm256_add_epi64(sum, SHA2_FUNC_6_AVX2(high));
+
+    return _mm256_blend_epi32(low, high, 0xF0);
+}
+
+// AVX2 version of sha2_update_block. The schedule is expanded 4 words at a
+// time in vectors and has the constants added to it, the rounds themselves
+// stay scalar and are interleaved with the schedule of the rounds ahead
+__attribute__((target("avx2")))
+static void sha2_update_blocks_avx2(uint64_t *state, const uint8_t *buffer, size_t blocks)
+{
+    const __m256i bswap = _mm256_set_epi64x(0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL,
+                                            0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL);
+    uint64_t wk[80];
+    __m256i w[4];
+
+    for(; blocks > 0; blocks--, buffer += 128)
+    {
+        uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for(int i = 0; i < 4; i++)
+        {
+            w[i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(buffer + 32 * i)), bswap);
+            _mm256_storeu_si256((__m256i *)&wk[4 * i],
+                                _mm256_add_epi64(w[i], _mm256_loadu_si256((const __m256i *)&sha2_const[4 * i])));
+        }
+
+        // Expand 8 words ahead while running 8 rounds
+        for(int t = 16; t < 80; t += 8)
+        {
+            for(int i = 0; i < 2; i++)
+            {
+                __m256i next = sha2_schedule_avx2(w[0], w[1], w[2], w[3]);
+                w[0] = w[1];
+                w[1] = w[2];
+                w[2] = w[3];
+                w[3] = next;
+                _mm256_storeu_si256((__m256i *)&wk[t + 4 * i],
+                                    _mm256_add_epi64(next, _mm256_loadu_si256((const __m256i *)&sha2_const[t + 4 * i])));
+            }
+            SHA2_ROUNDS_8(&wk[t - 16]);
+        }
+        SHA2_ROUNDS_8(&wk[64]);
+        SHA2_ROUNDS_8(&wk[72]);
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+#endif
+
+// Feed a run of 128 byte blocks into the fastest block function this CPU has
+static void sha2_update_blocks(struct sha2_context *ctx, const uint8_t *buffer, size_t blocks)
+{
+#ifdef NOTCRYPTO_X86_SIMD
+    if(cpu_has_avx2())
+    {
+        sha2_update_blocks_avx2(ctx->ctx_union.b64.state, buffer, blocks);
+        return;
+    }
+#endif
+    for(; blocks > 0; blocks--, buffer += 128)
+        sha2_update_block(ctx, buffer);
+}
+
 void sha2_512_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len)
 {
-    ctx->ctx_union.b64.len += len;
-    
+    // 128 bit byte counter
+    ctx->ctx_union.b64.len[0] += len;
+    if(ctx->ctx_union.b64.len[0] < len)
+        ctx->ctx_union.b64.len[1]++;
+
     // If our context has overflow bytes from the last update then extend those
     // until the overflow buffer has 64 bytes in it so we can process the block
     if(ctx->ctx_union.b64.bufused > 0)
@@ -188,17 +335,17 @@ void sha2_512_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len
 
         if(ctx->ctx_union.b64.bufused == 128)
         {
-            sha2_update_block(ctx, ctx->ctx_union.b64.buffer);
+            sha2_update_blocks(ctx, ctx->ctx_union.b64.buffer, 1);
             ctx->ctx_union.b64.bufused = 0;
         }
     }
 
-    // Feed 64 byte blocks into the update function
-    while(len >= 128)
+    // Feed 128 byte blocks into the update function
+    if(len >= 128)
     {
-        sha2_update_block(ctx, buffer);
-        len    -= 128;
-        buffer += 128;
+        sha2_update_blocks(ctx, buffer, len / 128);
+        buffer += len & ~(size_t)127;
+        len    &= 127;
     }
 
     // And save any overflow bytes for next update
@@ -215,46 +362,60 @@ void sha2_384_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len
 }
 
 
-void sha2_512_final(struct sha2_context *ctx, uint8_t *hash)
+void sha2_512_256_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len)
 {
-    // Apply padding and feed it into the update function
-    uint64_t len = ctx->ctx_union.b64.len * 8;
-    sha2_endianswap(&len, sizeof(uint64_t));
-    size_t padlen = 128 - ((ctx->ctx_union.b64.len + 16) % 128);
+    sha2_512_update(ctx, buffer, len);
+}
+
+void sha2_512_224_update(struct sha2_context *ctx, const uint8_t *buffer, size_t len)
+{
+    sha2_512_update(ctx, buffer, len);
+}
+
+// Shared by all final functions, they only differ in how much of the state
+// ends up in the hash
+static void sha2_64_final(struct sha2_context *ctx, uint8_t *hash, size_t hashsize)
+{
+    // Apply padding and feed it into the update function, the length is the
+    // 128 bit number of bits in the message
+    uint64_t len[2];
+    len[0] = (ctx->ctx_union.b64.len[1] << 3) | (ctx->ctx_union.b64.len[0] >> 61);
+    len[1] = ctx->ctx_union.b64.len[0] << 3;
+    sha2_endianswap(&len[0], sizeof(uint64_t));
+    sha2_endianswap(&len[1], sizeof(uint64_t));
+    size_t padlen = 128 - ((ctx->ctx_union.b64.len[0] + 16) % 128);
     uint8_t padding[128] = {0};
     padding[0] = 0x80;
 
     sha2_512_update(ctx, padding, padlen);
-    sha2_512_update(ctx, padding + 1, 8); // we dont actually support the full 128 bit size yet :(
-    sha2_512_update(ctx, (uint8_t *)&len, 8);
-    
+    sha2_512_update(ctx, (uint8_t *)len, 16);
+
     // Not required on big endian systems
     for(int i = 0; i < 8; i++)
         sha2_endianswap(&ctx->ctx_union.b64.state[i], sizeof(uint64_t));
-    
-    memcpy(hash, ctx->ctx_union.b64.state, 64);
+
+    memcpy(hash, ctx->ctx_union.b64.state, hashsize);
     memset(ctx, 0, sizeof(struct sha2_context));
 }
 
+void sha2_512_final(struct sha2_context *ctx, uint8_t *hash)
+{
+    sha2_64_final(ctx, hash, 64);
+}
+
 void sha2_384_final(struct sha2_context *ctx, uint8_t *hash)
 {
-    // Apply padding and feed it into the update function
-    uint64_t len = ctx->ctx_union.b64.len * 8;
-    sha2_endianswap(&len, sizeof(uint64_t));
-    size_t padlen = 128 - ((ctx->ctx_union.b64.len + 16) % 128);
-    uint8_t padding[128] = {0};
-    padding[0] = 0x80;
+    sha2_64_final(ctx, hash, 48);
+}
 
-    sha2_512_update(ctx, padding, padlen);
-    sha2_512_update(ctx, padding + 1, 8); // we dont actually support the full 128 bit size yet :(
-    sha2_512_update(ctx, (uint8_t *)&len, 8);
-    
-    // Not required on big endian systems
-    for(int i = 0; i < 7; i++)
-        sha2_endianswap(&ctx->ctx_union.b64.state[i], sizeof(uint64_t));
-    
-    memcpy(hash, ctx->ctx_union.b64.state, 48);
-    memset(ctx, 0, sizeof(struct sha2_context));
+void sha2_512_256_final(struct sha2_context *ctx, uint8_t *hash)
+{
+    sha2_64_final(ctx, hash, 32);
+}
+
+void sha2_512_224_final(struct sha2_context *ctx, uint8_t *hash)
+{
+    sha2_64_final(ctx, hash, 28);
 }
 
 void sha2_512(const uint8_t *buffer, size_t len, uint8_t *hash)
@@ -272,3 +433,219 @@ void sha2_384(const uint8_t *buffer, size_t len, uint8_t *hash)
     sha2_384_update(&ctx, buffer, len);
     sha2_384_final(&ctx, hash);
 }
+
+void sha2_512_256(const uint8_t *buffer, size_t len, uint8_t *hash)
+{
+    struct sha2_context ctx;
+    sha2_512_256_init(&ctx);
+    sha2_512_256_update(&ctx, buffer, len);
+    sha2_512_256_final(&ctx, hash);
+}
+
+void sha2_512_224(const uint8_t *buffer, size_t len, uint8_t *hash)
+{
+    struct sha2_context ctx;
+    sha2_512_224_init(&ctx);
+    sha2_512_224_update(&ctx, buffer, len);
+    sha2_512_224_final(&ctx, hash);
+}
+
+/* Multi buffer hashing, the lanes are driven by multibuffer.h with 4 lanes
+ * per ymm register and 8 per zmm register.
+ */
+
+#ifdef NOTCRYPTO_X86_SIMD
+// Run one block through 4 lanes with AVX2, same rounds as sha2_update_block
+__attribute__((target("avx2")))
+static void sha2_lanes_avx2(void *vstate, const uint8_t **blocks)
+{
+    uint64_t *state = vstate;
+    const __m256i bswap = _mm256_set_epi64x(0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL,
+                                            0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL);
+    __m256i w_buf[16];
+    __m256i lstate[8];
+    __m256i temp[2];
+
+    // Turn the 4 blocks into 16 vectors of message words
+    for(int quarter = 0; quarter < 4; quarter++)
+    {
+        for(int i = 0; i < 4; i++)
+            w_buf[4 * quarter + i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + 32 * quarter));
+        cpu_transpose_4x64(&w_buf[4 * quarter]);
+    }
+    for(int i = 0; i < 16; i++)
+        w_buf[i] = _mm256_shuffle_epi8(w_buf[i], bswap);
+
+    for(int i = 0; i < 8; i++)
+        lstate[i] = _mm256_loadu_si256((const __m256i *)&state[4 * i]);
+
+    for(int i = 0; i < 80; i++)
+    {
+        // Expand the schedule in place, w_buf only holds the last 16 words
+        if(i >= 16)
+            w_buf[i % 16] = _mm256_add_epi64(_mm256_add_epi64(w_buf[i % 16], SHA2_FUNC_5_AVX2(w_buf[(i - 15) % 16])),
+                                             _mm256_add_epi64(w_buf[(i - 7) % 16], SHA2_FUNC_6_AVX2(w_buf[(i - 2) % 16])));
+
+        __m256i e = lstate[4], a = lstate[0];
+        __m256i ch  = _mm256_xor_si256(_mm256_and_si256(e, lstate[5]), _mm256_andnot_si256(e, lstate[6]));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, lstate[1]), _mm256_and_si256(lstate[2], _mm256_or_si256(a, lstate[1])));
+        temp[0] = _mm256_add_epi64(_mm256_add_epi64(lstate[7], ch),
+                                   _mm256_add_epi64(SHA2_XOR3_AVX2(SHA2_ROT_AVX2(e, 14), SHA2_ROT_AVX2(e, 18), SHA2_ROT_AVX2(e, 41)),
+                                                    _mm256_add_epi64(_mm256_set1_epi64x(sha2_const[i]), w_buf[i % 16])));
+        temp[1] = _mm256_add_epi64(SHA2_XOR3_AVX2(SHA2_ROT_AVX2(a, 28), SHA2_ROT_AVX2(a, 34), SHA2_ROT_AVX2(a, 39)), maj);
+
+        lstate[7] = lstate[6];
+        lstate[6] = lstate[5];
+        lstate[5] = lstate[4];
+        lstate[4] = _mm256_add_epi64(lstate[3], temp[0]);
+        lstate[3] = lstate[2];
+        lstate[2] = lstate[1];
+        lstate[1] = lstate[0];
+        lstate[0] = _mm256_add_epi64(temp[0], temp[1]);
+    }
+
+    for(int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)&state[4 * i],
+                            _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)&state[4 * i]), lstate[i]));
+}
+
+// AVX-512 has a real rotate (vprorq) and vpternlogq for the logic functions
+# define SHA2_ROT_AVX512(x, bits) _mm512_ror_epi64(x, bits)
+# define SHA2_XOR3_AVX512(x, y, z) _mm512_ternarylogic_epi64(x, y, z, 0x96)
+# define SHA2_CH_AVX512(x, y, z) _mm512_ternarylogic_epi64(x, y, z, 0xCA)
+# define SHA2_MAJ_AVX512(x, y, z) _mm512_ternarylogic_epi64(x, y, z, 0xE8)
+
+// Run one block through 8 lanes with AVX-512
+__attribute__((target("avx512f,avx2")))
+static void sha2_lanes_avx512(void *vstate, const uint8_t **blocks)
+{
+    uint64_t *state = vstate;
+    const __m256i bswap = _mm256_set_epi64x(0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL,
+                                            0x08090a0b0c0d0e0fULL, 0x0001020304050607ULL);
+    __m512i w_buf[16];
+    __m512i lstate[8];
+    __m512i temp[2];
+
+    // Transpose lanes 0-3 and 4-7 separately and glue them together
+    for(int quarter = 0; quarter < 4; quarter++)
+    {
+        __m256i lo[4], hi[4];
+        for(int i = 0; i < 4; i++)
+        {
+            lo[i] = _mm256_loadu_si256((const __m256i *)(blocks[i] + 32 * quarter));
+            hi[i] = _mm256_loadu_si256((const __m256i *)(blocks[i + 4] + 32 * quarter));
+        }
+        cpu_transpose_4x64(lo);
+        cpu_transpose_4x64(hi);
+        for(int i = 0; i < 4; i++)
+            w_buf[4 * quarter + i] = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_shuffle_epi8(lo[i], bswap)),
+                                                        _mm256_shuffle_epi8(hi[i], bswap), 1);
+    }
+
+    for(int i = 0; i < 8; i++)
+        lstate[i] = _mm512_loadu_si512(&state[8 * i]);
+
+    for(int i = 0; i < 80; i++)
+    {
+        if(i >= 16)
+        {
+            __m512i w2 = w_buf[(i - 2) % 16], w15 = w_buf[(i - 15) % 16];
+            __m512i s1 = SHA2_XOR3_AVX512(SHA2_ROT_AVX512(w2, 19), SHA2_ROT_AVX512(w2, 61), _mm512_srli_epi64(w2, 6));
+            __m512i s0 = SHA2_XOR3_AVX512(SHA2_ROT_AVX512(w15, 1), SHA2_ROT_AVX512(w15, 8), _mm512_srli_epi64(w15, 7));
+            w_buf[i % 16] = _mm512_add_epi64(_mm512_add_epi64(w_buf[i % 16], s0),
+                                             _mm512_add_epi64(w_buf[(i - 7) % 16], s1));
+        }
+
+        __m512i e = lstate[4], a = lstate[0];
+        temp[0] = _mm512_add_epi64(_mm512_add_epi64(lstate[7], SHA2_CH_AVX512(e, lstate[5], lstate[6])),
+                                   _mm512_add_epi64(SHA2_XOR3_AVX512(SHA2_ROT_AVX512(e, 14), SHA2_ROT_AVX512(e, 18), SHA2_ROT_AVX512(e, 41)),
+                                                    _mm512_add_epi64(_mm512_set1_epi64(sha2_const[i]), w_buf[i % 16])));
+        temp[1] = _mm512_add_epi64(SHA2_XOR3_AVX512(SHA2_ROT_AVX512(a, 28), SHA2_ROT_AVX512(a, 34), SHA2_ROT_AVX512(a, 39)),
+                                   SHA2_MAJ_AVX512(a, lstate[1], lstate[2]));
+
+        lstate[7] = lstate[6];
+        lstate[6] = lstate[5];
+        lstate[5] = lstate[4];
+        lstate[4] = _mm512_add_epi64(lstate[3], temp[0]);
+        lstate[3] = lstate[2];
+        lstate[2] = lstate[1];
+        lstate[1] = lstate[0];
+        lstate[0] = _mm512_add_epi64(temp[0], temp[1]);
+    }
+
+    for(int i = 0; i < 8; i++)
+        _mm512_storeu_si512(&state[8 * i], _mm512_add_epi64(_mm512_loadu_si512(&state[8 * i]), lstate[i]));
+}
+#endif
+
+// Hash count messages starting from the state in ctx, which must not have any
+// buffered bytes for the lanes to be used
+static void sha2_64_xN(const struct sha2_context *ctx, size_t hashsize, const uint8_t *buffers[],
+                       const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    size_t width = 0;
+    multibuffer_lanefunc_t lanefunc = NULL;
+
+#ifdef NOTCRYPTO_X86_SIMD
+    if(count > 4 && cpu_has_avx512())
+    {
+        width = 8;
+        lanefunc = sha2_lanes_avx512;
+    }
+    else if(count > 1 && cpu_has_avx2())
+    {
+        width = 4;
+        lanefunc = sha2_lanes_avx2;
+    }
+#endif
+
+    // One message at a time if we can't do better
+    if(lanefunc == NULL || ctx->ctx_union.b64.bufused != 0)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            struct sha2_context lctx = *ctx;
+            sha2_512_update(&lctx, buffers[i], lens[i]);
+            sha2_64_final(&lctx, hashes[i], hashsize);
+        }
+        return;
+    }
+
+    struct multibuffer_hash mb = {128, 16, 1, 8, 8, hashsize, ctx->ctx_union.b64.state,
+                                  {ctx->ctx_union.b64.len[0], ctx->ctx_union.b64.len[1]}};
+    multibuffer_run(&mb, width, lanefunc, buffers, lens, hashes, count);
+}
+
+void sha2_512_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    struct sha2_context ctx;
+    sha2_512_init(&ctx);
+    sha2_64_xN(&ctx, 64, buffers, lens, hashes, count);
+}
+
+void sha2_512_xN_ctx(const struct sha2_context *ctx, const uint8_t *buffers[], const size_t lens[],
+                     uint8_t *hashes[], size_t count)
+{
+    sha2_64_xN(ctx, 64, buffers, lens, hashes, count);
+}
+
+void sha2_384_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    struct sha2_context ctx;
+    sha2_384_init(&ctx);
+    sha2_64_xN(&ctx, 48, buffers, lens, hashes, count);
+}
+
+void sha2_512_256_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    struct sha2_context ctx;
+    sha2_512_256_init(&ctx);
+    sha2_64_xN(&ctx, 32, buffers, lens, hashes, count);
+}
+
+void sha2_512_224_xN(const uint8_t *buffers[], const size_t lens[], uint8_t *hashes[], size_t count)
+{
+    struct sha2_context ctx;
+    sha2_512_224_init(&ctx);
+    sha2_64_xN(&ctx, 28, buffers, lens, hashes, count);
+}
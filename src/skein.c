@@ -0,0 +1,187 @@
+/* Copyright (C) 2011 by clueless <clueless@thunked.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* This code was implemented from the Skein 1.3 paper
+ * (https://www.schneier.com/skein1.3.pdf), it only implements plain hashing
+ * with an output as long as the internal state.  The block cipher is the
+ * Threefish code from threefish.c.  This code is written solely to learn about
+ * one way hash functions and Skein specifically.  This code should never be
+ * used in production, or anywhere else.  To the best of my knowledge the
+ * implementation is correct but you should assume there are errors in it.
+ */
+
+#include <string.h>
+#include "skein.h"
+#include "threefish.h"
+
+// Block types from the tweak, they go in bits 120 to 125
+#define SKEIN_TYPE_CFG 4
+#define SKEIN_TYPE_MSG 48
+#define SKEIN_TYPE_OUT 63
+
+#define SKEIN_FLAG_FIRST (1ULL << 62)
+#define SKEIN_FLAG_FINAL (1ULL << 63)
+
+// Start a new UBI call
+static void skein_ubi_start(struct skein_context *ctx)
+{
+    ctx->position = 0;
+    ctx->first = 1;
+    ctx->bufused = 0;
+}
+
+/* Run one block of a UBI call through Threefish with the chaining value as the
+ * key and xor the block back in. bytes is the number of message bytes in the
+ * block, which is only less than the block size for the final block.
+ */
+static void skein_ubi_block(struct skein_context *ctx, const uint8_t *block, size_t bytes, uint64_t type, int final)
+{
+    uint64_t tweak[2];
+
+    ctx->position += bytes;
+    tweak[0] = ctx->position;
+    tweak[1] = type << 56;
+    if(ctx->first)
+        tweak[1] |= SKEIN_FLAG_FIRST;
+    if(final)
+        tweak[1] |= SKEIN_FLAG_FINAL;
+    ctx->first = 0;
+
+    threefish_ubi(ctx->blocksize, ctx->state, block, (const uint8_t *)tweak);
+}
+
+// Process the configuration block and get ready for the message
+static void skein_init(struct skein_context *ctx, size_t blocksize)
+{
+    uint8_t config[128] = {'S', 'H', 'A', '3', 1, 0, 0, 0};
+    uint64_t outbits = blocksize * 8;
+
+    memset(ctx, 0, sizeof(struct skein_context));
+    ctx->blocksize = blocksize;
+
+    // The output length in bits follows the schema identifier and version,
+    // the tree parameters are all zero for sequential hashing
+    memcpy(config + 8, &outbits, sizeof(outbits));
+    skein_ubi_start(ctx);
+    skein_ubi_block(ctx, config, 32, SKEIN_TYPE_CFG, 1);
+
+    skein_ubi_start(ctx);
+}
+
+/* The final block of a UBI call has to be known before it is processed, so
+ * the buffer is only emptied when more data follows it.
+ */
+static void skein_update(struct skein_context *ctx, const uint8_t *buffer, size_t len)
+{
+    size_t blocksize = ctx->blocksize;
+
+    if(len == 0)
+        return;
+
+    // Fill up the buffer, it only gets processed if there's more input
+    if(ctx->bufused > 0 || len <= blocksize)
+    {
+        size_t cpylen = ((blocksize - ctx->bufused) <= len) ? blocksize - ctx->bufused : len;
+        memcpy(ctx->buffer + ctx->bufused, buffer, cpylen);
+        ctx->bufused += cpylen;
+        buffer += cpylen;
+        len -= cpylen;
+
+        if(len == 0)
+            return;
+        skein_ubi_block(ctx, ctx->buffer, blocksize, SKEIN_TYPE_MSG, 0);
+        ctx->bufused = 0;
+    }
+
+    // Whole blocks straight from the input, but keep the last one
+    while(len > blocksize)
+    {
+        skein_ubi_block(ctx, buffer, blocksize, SKEIN_TYPE_MSG, 0);
+        buffer += blocksize;
+        len -= blocksize;
+    }
+
+    memcpy(ctx->buffer, buffer, len);
+    ctx->bufused = len;
+}
+
+static void skein_final(struct skein_context *ctx, uint8_t *hash)
+{
+    size_t blocksize = ctx->blocksize;
+    uint8_t counter[128] = {0};
+
+    // The last message block is zero padded, an empty message is one block of
+    // zeroes
+    memset(ctx->buffer + ctx->bufused, 0, blocksize - ctx->bufused);
+    skein_ubi_block(ctx, ctx->buffer, ctx->bufused, SKEIN_TYPE_MSG, 1);
+
+    // Output is a UBI call on a 64 bit counter, one block is enough
+    skein_ubi_start(ctx);
+    skein_ubi_block(ctx, counter, 8, SKEIN_TYPE_OUT, 1);
+    memcpy(hash, ctx->state, blocksize);
+    memset(ctx, 0, sizeof(struct skein_context));
+}
+
+void skein_512_init(struct skein_context *ctx)
+{
+    skein_init(ctx, 64);
+}
+
+void skein_512_update(struct skein_context *ctx, const uint8_t *buffer, size_t len)
+{
+    skein_update(ctx, buffer, len);
+}
+
+void skein_512_final(struct skein_context *ctx, uint8_t *hash)
+{
+    skein_final(ctx, hash);
+}
+
+void skein_512(const uint8_t *buffer, size_t len, uint8_t *hash)
+{
+    struct skein_context ctx;
+    skein_512_init(&ctx);
+    skein_512_update(&ctx, buffer, len);
+    skein_512_final(&ctx, hash);
+}
+
+void skein_1024_init(struct skein_context *ctx)
+{
+    skein_init(ctx, 128);
+}
+
+void skein_1024_update(struct skein_context *ctx, const uint8_t *buffer, size_t len)
+{
+    skein_update(ctx, buffer, len);
+}
+
+void skein_1024_final(struct skein_context *ctx, uint8_t *hash)
+{
+    skein_final(ctx, hash);
+}
+
+void skein_1024(const uint8_t *buffer, size_t len, uint8_t *hash)
+{
+    struct skein_context ctx;
+    skein_1024_init(&ctx);
+    skein_1024_update(&ctx, buffer, len);
+    skein_1024_final(&ctx, hash);
+}
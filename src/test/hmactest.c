@@ -85,6 +85,22 @@
         "\x88\x1d\xc2\x00\xc9\x83\x3d\xa7\x26\xe9\x37\x6c\x2e\x32\xcf\xf7", \
         32, "HMAC-SHA2-256 Test 1" \
     }, \
+    { \
+        "Test Using Larger Than Block-Size Key - Hash Key First", 54, \
+        "\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA" \
+        "\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA" \
+        "\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA" \
+        "\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA" \
+        "\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA" \
+        "\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA" \
+        "\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA" \
+        "\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA\xAA" \
+        "\xAA\xAA\xAA", 131, \
+        HMAC_SHA2_256, \
+        "\x60\xe4\x31\x59\x1e\xe0\xb6\x7f\x0d\x8a\x26\xaa\xcb\xf5\xb7\x7f" \
+        "\x8e\x0b\xc6\x21\x37\x28\xc5\x14\x05\x46\x04\x0f\x0e\xe3\x7f\x54", \
+        32, "HMAC-SHA2-256 Test 2" \
+    }, \
     { \
         "Hi There", 8, \
         "\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b", 20, \
@@ -103,6 +119,22 @@
         "\xda\xa8\x33\xb7\xd6\xb8\xa7\x02\x03\x8b\x27\x4e\xae\xa3\xf4\xe4" \
         "\xbe\x9d\x91\x4e\xeb\x61\xf1\x70\x2e\x69\x6c\x20\x3a\x12\x68\x54", \
         64, "HMAC-SHA2-512 Test 1" \
+    }, \
+    { \
+        "Hi There", 8, \
+        "\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b", 20, \
+        HMAC_SHA2_512_224, \
+        "\xb2\x44\xba\x01\x30\x7c\x0e\x7a\x8c\xca\xad\x13\xb1\x06\x7a\x4c" \
+        "\xf6\xb9\x61\xfe\x0c\x6a\x20\xbd\xa3\xd9\x20\x39", \
+        28, "HMAC-SHA2-512/224 Test 1" \
+    }, \
+    { \
+        "Hi There", 8, \
+        "\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b", 20, \
+        HMAC_SHA2_512_256, \
+        "\x9f\x91\x26\xc3\xd9\xc3\xc3\x30\xd7\x60\x42\x5c\xa8\xa2\x17\xe3" \
+        "\x1f\xea\xe3\x1b\xfe\x70\x19\x6f\xf8\x16\x42\xb8\x68\x40\x2e\xab", \
+        32, "HMAC-SHA2-512/256 Test 1" \
     } \
 }
 
@@ -124,6 +156,162 @@ void printhex(uint8_t *bytes, size_t len)
         printf("%02x", bytes[i]);
 }
 
+// MAC through the functions for a single hash, with the message split in two
+// pieces. Returns 0 for hashes that don't have their own functions.
+int specialized_hmac(const struct testentry *entry, uint8_t *mac)
+{
+    const uint8_t *key = (const uint8_t *)entry->key;
+    const uint8_t *data = (const uint8_t *)entry->data;
+    size_t half = entry->datalen / 2;
+
+#define SPECIALIZED(name) \
+    { \
+        struct hmac_##name##_key hkey; \
+        struct hmac_##name##_context ctx; \
+        hmac_##name##_key_init(&hkey, key, entry->keylen); \
+        hmac_##name##_init_key(&ctx, &hkey); \
+        hmac_##name##_update(&ctx, data, half); \
+        hmac_##name##_update(&ctx, data + half, entry->datalen - half); \
+        hmac_##name##_final(&ctx, mac); \
+        return 1; \
+    }
+
+    switch(entry->hashtype)
+    {
+        case HMAC_MD5:
+            SPECIALIZED(md5)
+        case HMAC_SHA1:
+            SPECIALIZED(sha1)
+        case HMAC_SHA2_224:
+            SPECIALIZED(sha2_224)
+        case HMAC_SHA2_256:
+            SPECIALIZED(sha2_256)
+        case HMAC_SHA2_384:
+            SPECIALIZED(sha2_384)
+        case HMAC_SHA2_512:
+            SPECIALIZED(sha2_512)
+    }
+    return 0;
+}
+
+// MAC a batch of messages of different lengths under short and long keys and
+// compare every MAC with the generic functions, which go through the function
+// pointers instead of the per-hash functions the batch code is built from
+void runtest_batch()
+{
+    static const size_t counts[] = {1, 14, 27, 40, 150};
+    static uint8_t data[150 * 300];
+    const uint8_t *buffers[150];
+    size_t lens[150];
+    uint8_t macs[150][64];
+    uint8_t *macptrs[150];
+    uint8_t key[200];
+    uint8_t expect[64];
+
+    for(size_t i = 0; i < sizeof(data); i++)
+        data[i] = i * 31 + 7;
+    for(size_t i = 0; i < sizeof(key); i++)
+        key[i] = i ^ 0x5A;
+    for(size_t i = 0; i < 150; i++)
+    {
+        buffers[i] = data + i * 300;
+        lens[i] = (i * 37) % 300;
+        macptrs[i] = macs[i];
+    }
+
+#define BATCHTEST(name, hashtype, macsize) \
+    for(size_t keylen = 10; keylen <= 200; keylen += 190) \
+    { \
+        struct hmac_##name##_key hkey; \
+        int ok = 1; \
+        hmac_##name##_key_init(&hkey, key, keylen); \
+        for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) \
+        { \
+            hmac_##name##_xN(&hkey, buffers, lens, macptrs, counts[c]); \
+            for(size_t i = 0; i < counts[c]; i++) \
+            { \
+                struct hmac_context ctx; \
+                hmac_init(&ctx, key, keylen, hashtype); \
+                hmac_update(&ctx, buffers[i], lens[i]); \
+                hmac_final(&ctx, expect); \
+                ok &= (memcmp(macs[i], expect, macsize) == 0); \
+            } \
+        } \
+        printf("HMAC-" #name " batch, key %zu bytes %s\n", keylen, ok ? "OK" : "ERROR"); \
+    }
+
+    BATCHTEST(sha1, HMAC_SHA1, 20)
+    BATCHTEST(sha2_256, HMAC_SHA2_256, 32)
+    BATCHTEST(sha2_512, HMAC_SHA2_512, 64)
+}
+
+// HMAC-Skein has no published vectors, work it out by hand from the Skein
+// functions for a key shorter and one longer than a block
+void runtest_skein()
+{
+    static const struct
+    {
+        const char *name;
+        int hashtype;
+        size_t blocksize;
+        void (*hash)(const uint8_t *, size_t, uint8_t *);
+    } hashes[] = {
+        {"Skein-512", HMAC_SKEIN_512, 64, skein_512},
+        {"Skein-1024", HMAC_SKEIN_1024, 128, skein_1024}
+    };
+    uint8_t key[300], msg[500], block[128 + 500];
+    uint8_t keyblock[128], inner[128], expect[128], mac[128];
+
+    for(size_t i = 0; i < sizeof(key); i++)
+        key[i] = i * 7 + 1;
+    for(size_t i = 0; i < sizeof(msg); i++)
+        msg[i] = i * 13 + 5;
+
+    for(size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++)
+    {
+        size_t bs = hashes[h].blocksize;
+
+        for(size_t keylen = 20; keylen <= 300; keylen += 280)
+        {
+            // The hash size equals the block size, so a long key hashes to a
+            // full block
+            memset(keyblock, 0, sizeof(keyblock));
+            if(keylen > bs)
+                hashes[h].hash(key, keylen, keyblock);
+            else
+                memcpy(keyblock, key, keylen);
+
+            for(size_t i = 0; i < bs; i++)
+                block[i] = keyblock[i] ^ HMAC_IPAD;
+            memcpy(block + bs, msg, sizeof(msg));
+            hashes[h].hash(block, bs + sizeof(msg), inner);
+            for(size_t i = 0; i < bs; i++)
+                block[i] = keyblock[i] ^ HMAC_OPAD;
+            memcpy(block + bs, inner, bs);
+            hashes[h].hash(block, 2 * bs, expect);
+
+            hmac(msg, sizeof(msg), key, keylen, mac, hashes[h].hashtype);
+            printf("HMAC-%s, key %zu bytes %s\n", hashes[h].name, keylen,
+                   (memcmp(mac, expect, bs) == 0) ? "OK" : "ERROR");
+        }
+    }
+}
+
+// An unknown hash type is refused and leaves a key that can be told apart
+void runtest_unknown()
+{
+    struct hmac_key hkey;
+    struct hmac_context ctx;
+    uint8_t key[16] = {0}, mac[64];
+    int ok = 1;
+
+    ok &= (hmac_key_init(&hkey, key, sizeof(key), -1) == -1 && hkey.hashsize == 0);
+    ok &= (hmac_init(&ctx, key, sizeof(key), HMAC_SKEIN_1024 + 1) == -1 && ctx.hashsize == 0);
+    ok &= (hmac(key, sizeof(key), key, sizeof(key), mac, -1) == -1);
+    ok &= (hmac(key, sizeof(key), key, sizeof(key), mac, HMAC_SHA2_256) == 0);
+    printf("HMAC unknown hash type %s\n", ok ? "OK" : "ERROR");
+}
+
 int main()
 {
     struct testentry entries[] = TEST_INITIALIZER; 
@@ -135,12 +323,31 @@ int main()
              entries[i].keylen, digest, entries[i].hashtype);
         hex_encode(hexdigest, digest, entries[i].macsize);
         printf("%s %s ", entries[i].name, hexdigest);
-        if(memcmp(digest, entries[i].hmac, entries[i].macsize) == 0)
-            printf("OK\n");
-        else
+
+        // The same MAC from a key object, used twice
+        struct hmac_key hkey;
+        uint8_t keyed[2][entries[i].macsize];
+        hmac_key_init(&hkey, (uint8_t *)entries[i].key, entries[i].keylen, entries[i].hashtype);
+        for(int n = 0; n < 2; n++)
+            hmac_with_key(&hkey, (uint8_t *)entries[i].data, entries[i].datalen, keyed[n]);
+
+        uint8_t special[entries[i].macsize];
+        int hasspecial = specialized_hmac(&entries[i], special);
+
+        if(memcmp(digest, entries[i].hmac, entries[i].macsize) != 0)
         {
             hex_encode(hexdigest, (uint8_t *)entries[i].hmac, entries[i].macsize);
             printf("ERROR EXPECTED %s\n", hexdigest);
         }
+        else if(memcmp(keyed[0], digest, entries[i].macsize) != 0 || memcmp(keyed[1], digest, entries[i].macsize) != 0)
+            printf("ERROR KEY OBJECT\n");
+        else if(hasspecial && memcmp(special, digest, entries[i].macsize) != 0)
+            printf("ERROR SPECIALIZED\n");
+        else
+            printf("OK\n");
     }
+
+    runtest_batch();
+    runtest_skein();
+    runtest_unknown();
 }
@@ -23,6 +23,7 @@
 #include <string.h>
 #include "md2.h"
 #include "hex.h"
+#include "xntest.h"
 
 int main()
 {
@@ -59,4 +60,6 @@ int main()
         else
             printf("\n  ERROR! Expected %s\n\n", test_hash[i]);
     }
+
+    runtests_xN("MD2", 16, 16, 0, md2, md2_xN);
 }
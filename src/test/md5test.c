@@ -23,6 +23,7 @@
 #include <string.h>
 #include "md5.h"
 #include "hex.h"
+#include "xntest.h"
 
 int main()
 {
@@ -60,4 +61,6 @@ int main()
         else
             printf("\n  ERROR! Expected %s\n\n", test_hash[i]);
     }
+
+    runtests_xN("MD5", 16, 64, 8, md5, md5_xN);
 }
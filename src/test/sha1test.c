@@ -23,6 +23,7 @@
 #include <string.h>
 #include "sha1.h"
 #include "hex.h"
+#include "xntest.h"
 
 int main()
 {
@@ -60,4 +61,6 @@ int main()
         else
             printf("\n  ERROR! Expected %s\n\n", test_hash[i]);
     }
+
+    runtests_xN("SHA1", 20, 64, 8, sha1, sha1_xN);
 }
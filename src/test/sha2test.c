@@ -27,6 +27,7 @@
 #include <string.h>
 #include "sha2.h"
 #include "hex.h"
+#include "xntest.h"
 
 struct testdata
 {
@@ -138,6 +139,25 @@ const struct testdata tests512[] =
      "aab45bc7ca1113c8ce0f3c32e1399de9c459535e8816521ab714b2a6cd200525"}
 };
 
+// Truncated SHA2-512 vectors from the FIPS 180-4 examples
+const struct testdata tests512_224[] =
+{
+    {0, (const uint8_t *)"", (const uint8_t *)"6ed0dd02806fa89e25de060c19d3ac86cabb87d6a0ddd05c333b84f4"},
+    {3, (const uint8_t *)"abc", (const uint8_t *)"4634270f707b6a54daae7530460842e20e37ed265ceee9a43e8924aa"},
+    {112, (const uint8_t *)"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+                           "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+     (const uint8_t *)"23fec5bb94d60b23308192640b0c453335d664734fe40e7268674af9"}
+};
+
+const struct testdata tests512_256[] =
+{
+    {0, (const uint8_t *)"", (const uint8_t *)"c672b8d1ef56ed28ab87c3622c5114069bdd3ad7b8f9737498d0c01ecef0967a"},
+    {3, (const uint8_t *)"abc", (const uint8_t *)"53048e2681941ef99b2e29b76b4c7dabe4c2d0c634fc6d46e0e2f13107e7af23"},
+    {112, (const uint8_t *)"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+                           "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+     (const uint8_t *)"3928e184fb8690f840da3988121d31be65cb9d3ef83ee6146feac861e19b563a"}
+};
+
 void runtests(char *name, const struct testdata *tests, size_t testsize,
               size_t hashsize, void (*hashfunction)(const uint8_t *, size_t, uint8_t*))
 {
@@ -162,4 +182,12 @@ int main()
     runtests("SHA2-256", tests256, 6, 32, sha2_256);
     runtests("SHA2-384", tests384, 6, 48, sha2_384);
     runtests("SHA2-512", tests512, 6, 64, sha2_512);
+    runtests("SHA2-512/224", tests512_224, 3, 28, sha2_512_224);
+    runtests("SHA2-512/256", tests512_256, 3, 32, sha2_512_256);
+    runtests_xN("SHA2-224", 28, 64, 8, sha2_224, sha2_224_xN);
+    runtests_xN("SHA2-256", 32, 64, 8, sha2_256, sha2_256_xN);
+    runtests_xN("SHA2-384", 48, 128, 16, sha2_384, sha2_384_xN);
+    runtests_xN("SHA2-512", 64, 128, 16, sha2_512, sha2_512_xN);
+    runtests_xN("SHA2-512/224", 28, 128, 16, sha2_512_224, sha2_512_224_xN);
+    runtests_xN("SHA2-512/256", 32, 128, 16, sha2_512_256, sha2_512_256_xN);
 }
@@ -0,0 +1,132 @@
+/* Copyright (C) 2011 by clueless <clueless@thunked.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Test vectors from appendix C of the Skein 1.3 paper
+ * (https://www.schneier.com/skein1.3.pdf), the empty message vectors come from
+ * the Skein NIST submission.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "skein.h"
+#include "hex.h"
+
+struct testdata
+{
+    size_t size;
+    const char *hash;
+};
+
+// The inputs are the first size bytes of 0xff, 0xfe, 0xfd, ...
+const struct testdata tests512[] =
+{
+    {0, "bc5b4c50925519c290cc634277ae3d6257212395cba733bbad37a4af0fa06af4"
+        "1fca7903d06564fea7a2d3730dbdb80c1f85562dfcc070334ea4d1d9e72cba7a"},
+    {1, "71b7bce6fe6452227b9ced6014249e5bf9a9754c3ad618ccc4e0aae16b316cc8"
+        "ca698d864307ed3e80b6ef1570812ac5272dc409b5a012df2a579102f340617a"},
+    {64, "45863ba3be0c4dfc27e75d358496f4ac9a736a505d9313b42b2f5eada79fc17f"
+         "63861e947afb1d056aa199575ad3f8c9a3cc1780b5e5fa4cae050e989876625b"},
+    {128, "91cca510c263c4ddd010530a33073309628631f308747e1bcbaa90e451cab92e"
+          "5188087af4188773a332303e6667a7a210856f742139000071f48e8ba2a5adb7"}
+};
+
+const struct testdata tests1024[] =
+{
+    {0, "0fff9563bb3279289227ac77d319b6fff8d7e9f09da1247b72a0a265cd6d2a62"
+        "645ad547ed8193db48cff847c06494a03f55666d3b47eb4c20456c9373c86297"
+        "d630d5578ebd34cb40991578f9f52b18003efa35d3da6553ff35db91b81ab890"
+        "bec1b189b7f52cb2a783ebb7d823d725b0b4a71f6824e88f68f982eefc6d19c6"},
+    {1, "e62c05802ea0152407cdd8787fda9e35703de862a4fbc119cff8590afe79250b"
+        "ccc8b3faf1bd2422ab5c0d263fb2f8afb3f796f048000381531b6f00d85161bc"
+        "0fff4bef2486b1ebcd3773fabf50ad4ad5639af9040e3f29c6c931301bf79832"
+        "e9da09857e831e82ef8b4691c235656515d437d2bda33bcec001c67ffde15ba8"},
+    {128, "1f3e02c46fb80a3fcd2dfbbc7c173800b40c60c2354af551189ebf433c3d85f9"
+          "ff1803e6d920493179ed7ae7fce69c3581a5a2f82d3e0c7a295574d0cd7d217c"
+          "484d2f6313d59a7718ead07d0729c24851d7e7d2491b902d489194e6b7d369db"
+          "0ab7aa106f0ee0a39a42efc54f18d93776080985f907574f995ec6a37153a578"},
+    {256, "842a53c99c12b0cf80cf69491be5e2f7515de8733b6ea9422dfd676665b5fa42"
+          "ffb3a9c48c217777950848cecdb48f640f81fb92bef6f88f7a85c1f7cd1446c9"
+          "161c0afe8f25ae444f40d3680081c35aa43f640fd5fa3c3c030bcc06abac01d0"
+          "98bcc984ebd8322712921e00b1ba07d6d01f26907050255ef2c8e24f716c52a5"}
+};
+
+void runtests(char *name, const struct testdata *tests, size_t testsize, size_t hashsize,
+              void (*hashfunction)(const uint8_t *, size_t, uint8_t *))
+{
+    uint8_t input[256];
+    uint8_t hash[128];
+    char hexhash[257];
+
+    for(size_t i = 0; i < sizeof(input); i++)
+        input[i] = 0xff - i;
+
+    for(size_t i = 0; i < testsize; i++)
+    {
+        printf("%s Test #%zu\t", name, i + 1);
+        hashfunction(input, tests[i].size, hash);
+        hex_encode(hexhash, hash, hashsize);
+        if(strcmp(hexhash, tests[i].hash) != 0)
+            printf("Failed! Got %s but expected %s\n", hexhash, tests[i].hash);
+        else
+            printf("OK!\n");
+    }
+}
+
+// Feed the same message in pieces of every size and compare with the one shot
+// function, this covers the buffering around the last block
+void runtests_pieces(char *name, size_t hashsize, void (*hashfunction)(const uint8_t *, size_t, uint8_t *),
+                     void (*init)(struct skein_context *),
+                     void (*update)(struct skein_context *, const uint8_t *, size_t),
+                     void (*final)(struct skein_context *, uint8_t *))
+{
+    struct skein_context ctx;
+    uint8_t input[700];
+    uint8_t expect[128], hash[128];
+    int ok = 1;
+
+    for(size_t i = 0; i < sizeof(input); i++)
+        input[i] = i * 7 + 3;
+    hashfunction(input, sizeof(input), expect);
+
+    printf("%s pieces\t", name);
+    for(size_t piece = 1; piece <= 300; piece++)
+    {
+        init(&ctx);
+        for(size_t offset = 0; offset < sizeof(input); offset += piece)
+            update(&ctx, input + offset, (sizeof(input) - offset < piece) ? sizeof(input) - offset : piece);
+        final(&ctx, hash);
+        ok &= (memcmp(hash, expect, hashsize) == 0);
+    }
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
+
+int main()
+{
+    runtests("Skein-512", tests512, sizeof(tests512) / sizeof(struct testdata), 64, skein_512);
+    runtests("Skein-1024", tests1024, sizeof(tests1024) / sizeof(struct testdata), 128, skein_1024);
+    runtests_pieces("Skein-512", 64, skein_512, skein_512_init, skein_512_update, skein_512_final);
+    runtests_pieces("Skein-1024", 128, skein_1024, skein_1024_init, skein_1024_update, skein_1024_final);
+    return 0;
+}
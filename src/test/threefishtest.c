@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threefish.h"
+#include "hmac.h"
 
 // NULL tests
 static uint8_t null_data[128] = {0};
@@ -158,6 +159,406 @@ void runtest(char *name, int size, const uint8_t *input, const uint8_t *key, con
         printf("\tDecryption failed\n");
 }
 
+// Encrypt a few blocks with different tweaks under one expanded key and compare
+// them against threefish
+void runtest_key(char *name, int size)
+{
+    struct threefish_key key;
+    uint8_t text[128], expect[128], tweak[16];
+    int ok = 1;
+
+    printf("%s:\t", name);
+    threefish_setkey(&key, size, key_data);
+    for(int i = 0; i < 8; i++)
+    {
+        memcpy(tweak, tweak_data, 16);
+        tweak[0] += i;
+        memcpy(text, input_data, size);
+        memcpy(expect, input_data, size);
+
+        threefish_encrypt_block(&key, tweak, text);
+        threefish(THREEFISH_ENCRYPT, size, key_data, tweak, expect);
+        ok &= (memcmp(text, expect, size) == 0);
+
+        threefish_decrypt_block(&key, tweak, text);
+        ok &= (memcmp(text, input_data, size) == 0);
+    }
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
+// Compare threefish_512_xN against threefish_encrypt_block with blocks under
+// two different keys and a different tweak for every block
+void runtests_xN(void)
+{
+    static const size_t counts[] = {1, 3, 4, 13};
+    struct threefish_key key[2];
+    const struct threefish_key *keys[16];
+    uint8_t tweaks[16][16], plain[16][64], text[16][64], expect[16][64];
+    const uint8_t *tweakptrs[16];
+    uint8_t *textptrs[16];
+
+    threefish_setkey(&key[0], 64, key_data);
+    threefish_setkey(&key[1], 64, null_data);
+    for(int i = 0; i < 16; i++)
+    {
+        keys[i] = &key[i % 3 == 2];
+        memcpy(tweaks[i], tweak_data, 16);
+        tweaks[i][15] ^= i;
+        memcpy(plain[i], input_data + i, 64);
+        tweakptrs[i] = tweaks[i];
+        textptrs[i] = text[i];
+    }
+
+    for(int t = 0; t < 4; t++)
+    {
+        int ok = 1;
+        printf("Threefish-512 xN #%d:\t", t + 1);
+        for(size_t i = 0; i < counts[t]; i++)
+        {
+            memcpy(text[i], plain[i], 64);
+            memcpy(expect[i], plain[i], 64);
+            threefish_encrypt_block(keys[i], tweaks[i], expect[i]);
+        }
+
+        threefish_512_xN(THREEFISH_ENCRYPT, keys, tweakptrs, textptrs, counts[t]);
+        for(size_t i = 0; i < counts[t]; i++)
+            ok &= (memcmp(textptrs[i], expect[i], 64) == 0);
+
+        threefish_512_xN(THREEFISH_DECRYPT, keys, tweakptrs, textptrs, counts[t]);
+        for(size_t i = 0; i < counts[t]; i++)
+            ok &= (memcmp(textptrs[i], plain[i], 64) == 0);
+
+        if(ok)
+            printf("OK!\n");
+        else
+            printf("Failed!\n");
+    }
+}
+// Counter mode over a buffer big enough for several threads, compared against
+// single blocks and against running it on one thread
+void runtest_ctr(char *name, int size)
+{
+    static uint8_t plain[1000003], one[1000003], many[1000003];
+    struct threefish_key key;
+    uint8_t block[128], tweak[16] = {0};
+    uint64_t counter = 0xfffffffffffffff0U;
+    int ok = 1;
+
+    printf("%s:\t", name);
+    threefish_setkey(&key, size, key_data);
+    for(size_t i = 0; i < sizeof(plain); i++)
+        plain[i] = i * 13 + 5;
+
+    threefish_ctr(&key, input_data, counter, plain, one, sizeof(plain), 1);
+    threefish_ctr(&key, input_data, counter, plain, many, sizeof(plain), 4);
+    ok &= (memcmp(one, many, sizeof(plain)) == 0);
+
+    // The first blocks, including the counter wrapping around
+    for(uint64_t b = 0; b < 20; b++)
+    {
+        uint64_t c = counter + b;
+        memcpy(tweak, &c, 8);
+        memcpy(block, input_data, size);
+        threefish_encrypt_block(&key, tweak, block);
+        for(int i = 0; i < size; i++)
+            ok &= (one[b * size + i] == (plain[b * size + i] ^ block[i]));
+    }
+
+    threefish_ctr(&key, input_data, counter, many, many, sizeof(plain), 3);
+    ok &= (memcmp(plain, many, sizeof(plain)) == 0);
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
+// ECB and CBC on unaligned buffers of a few chunks, checked block by block with
+// threefish_encrypt_block
+void runtest_modes(char *name, int size)
+{
+    static uint8_t plain[128 * 100 + 1], cipher[128 * 100 + 1], text[128 * 100 + 1];
+    struct threefish_key key;
+    size_t len = 100 * size;
+    uint8_t block[128];
+    int ok = 1;
+
+    printf("%s:\t", name);
+    threefish_setkey(&key, size, key_data);
+    for(size_t i = 0; i < len; i++)
+        plain[i + 1] = i * 13 + 5;
+
+    // ECB
+    threefish_ecb(THREEFISH_ENCRYPT, &key, tweak_data, plain + 1, cipher + 1, len);
+    for(size_t b = 0; b < len; b += size)
+    {
+        memcpy(block, plain + 1 + b, size);
+        threefish_encrypt_block(&key, tweak_data, block);
+        ok &= (memcmp(block, cipher + 1 + b, size) == 0);
+    }
+    threefish_ecb(THREEFISH_DECRYPT, &key, tweak_data, cipher + 1, text + 1, len);
+    ok &= (memcmp(text + 1, plain + 1, len) == 0);
+
+    // CBC, decrypted once out of place and once in place
+    threefish_cbc(THREEFISH_ENCRYPT, &key, tweak_data, input_data, plain + 1, cipher + 1, len);
+    memcpy(block, input_data, size);
+    for(size_t b = 0; b < len; b += size)
+    {
+        for(int i = 0; i < size; i++)
+            block[i] ^= plain[1 + b + i];
+        threefish_encrypt_block(&key, tweak_data, block);
+        ok &= (memcmp(block, cipher + 1 + b, size) == 0);
+    }
+    threefish_cbc(THREEFISH_DECRYPT, &key, tweak_data, input_data, cipher + 1, text + 1, len);
+    ok &= (memcmp(text + 1, plain + 1, len) == 0);
+    threefish_cbc(THREEFISH_DECRYPT, &key, tweak_data, input_data, cipher + 1, cipher + 1, len);
+    ok &= (memcmp(cipher + 1, plain + 1, len) == 0);
+
+    ok &= (threefish_cbc(THREEFISH_ENCRYPT, &key, tweak_data, input_data, plain, cipher, len - 1) == -1);
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
+// Encrypt a run of sectors and check that a single sector in the middle
+// decrypts on its own and matches a block encrypted by hand
+void runtest_sectors(char *name, int size)
+{
+    static uint8_t plain[512 * 20], cipher[512 * 20];
+    struct threefish_key key;
+    uint8_t block[128], sector[512];
+    uint64_t tweak[2] = {1000 + 13, 3};
+    int ok = 1;
+
+    printf("%s:\t", name);
+    threefish_setkey(&key, size, key_data);
+    for(size_t i = 0; i < sizeof(plain); i++)
+        plain[i] = i * 13 + 5;
+
+    threefish_sectors(THREEFISH_ENCRYPT, &key, 1000, 512, plain, cipher, 20);
+
+    memcpy(block, plain + 13 * 512 + 3 * size, size);
+    threefish_encrypt_block(&key, (uint8_t *)tweak, block);
+    ok &= (memcmp(block, cipher + 13 * 512 + 3 * size, size) == 0);
+
+    threefish_sectors(THREEFISH_DECRYPT, &key, 1013, 512, cipher + 13 * 512, sector, 1);
+    ok &= (memcmp(sector, plain + 13 * 512, 512) == 0);
+
+    threefish_sectors(THREEFISH_DECRYPT, &key, 1000, 512, cipher, cipher, 20);
+    ok &= (memcmp(cipher, plain, sizeof(plain)) == 0);
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
+// The generator must match counter mode over zeroes, also after a seek and
+// when filled in odd sized pieces
+void runtest_rng(char *name, int size)
+{
+    static uint8_t zero[128 * 200], stream[128 * 200], random[128 * 200];
+    struct threefish_rng rng;
+    struct threefish_key key;
+    int ok = 1;
+
+    printf("%s:\t", name);
+    threefish_setkey(&key, size, key_data);
+    threefish_ctr(&key, null_data, 0, zero, stream, sizeof(stream), 1);
+
+    threefish_rng_init(&rng, size, key_data);
+    threefish_rng_fill(&rng, random, 200 * size);
+    ok &= (memcmp(random, stream, 200 * size) == 0);
+
+    // Fill block 150 and on, then 20 to 150 in a piece that ends mid block
+    threefish_rng_seek(&rng, 150);
+    threefish_rng_fill(&rng, random, 50 * size);
+    ok &= (memcmp(random, stream + 150 * size, 50 * size) == 0);
+    threefish_rng_seek(&rng, 20);
+    threefish_rng_fill(&rng, random, 130 * size - 5);
+    ok &= (memcmp(random, stream + 20 * size, 130 * size - 5) == 0);
+    threefish_rng_fill(&rng, random, size);
+    ok &= (memcmp(random, stream + 150 * size, size) == 0);
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
+// The fused functions must give the same result as threefish_ctr and hmac one
+// after the other, and decryption has to catch a changed byte
+void runtest_ctr_hmac(char *name, int size)
+{
+    static uint8_t plain[10007], cipher[10007], expect[10007];
+    struct threefish_key key;
+    struct hmac_context hctx;
+    uint8_t mac[32], expectmac[32], nonce[128];
+    const uint8_t counter[8] = {7};
+    int ok = 1;
+
+    printf("%s:\t", name);
+    threefish_setkey(&key, size, key_data);
+    for(size_t i = 0; i < sizeof(plain); i++)
+        plain[i] = i * 13 + 5;
+
+    threefish_ctr_hmac_encrypt(&key, input_data, 7, tweak_data, 16, HMAC_SHA2_256, plain, cipher, sizeof(plain), mac);
+    threefish_ctr(&key, input_data, 7, plain, expect, sizeof(plain), 1);
+    hmac_init(&hctx, tweak_data, 16, HMAC_SHA2_256);
+    hmac_update(&hctx, input_data, size);
+    hmac_update(&hctx, counter, sizeof(counter));
+    hmac_update(&hctx, expect, sizeof(expect));
+    hmac_final(&hctx, expectmac);
+    ok &= (memcmp(cipher, expect, sizeof(plain)) == 0);
+    ok &= (memcmp(mac, expectmac, 32) == 0);
+
+    ok &= (threefish_ctr_hmac_decrypt(&key, input_data, 7, tweak_data, 16, HMAC_SHA2_256,
+                                      cipher, expect, sizeof(plain), mac) == 0);
+    ok &= (memcmp(expect, plain, sizeof(plain)) == 0);
+
+    // The MAC doesn't hold for another nonce or counter
+    memcpy(nonce, input_data, size);
+    nonce[size - 1] ^= 1;
+    ok &= (threefish_ctr_hmac_decrypt(&key, nonce, 7, tweak_data, 16, HMAC_SHA2_256,
+                                      cipher, expect, sizeof(plain), mac) == -1);
+    ok &= (threefish_ctr_hmac_decrypt(&key, input_data, 8, tweak_data, 16, HMAC_SHA2_256,
+                                      cipher, expect, sizeof(plain), mac) == -1);
+
+    cipher[5000] ^= 1;
+    ok &= (threefish_ctr_hmac_decrypt(&key, input_data, 7, tweak_data, 16, HMAC_SHA2_256,
+                                      cipher, cipher, sizeof(plain), mac) == -1);
+    ok &= (cipher[0] == 0 && cipher[sizeof(plain) - 1] == 0);
+
+    // An unknown hash is refused before anything is encrypted
+    ok &= (threefish_ctr_hmac_encrypt(&key, input_data, 7, tweak_data, 16, -1, plain, cipher, sizeof(plain), mac) == -1);
+    ok &= (cipher[0] == 0);
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
+// The bulk MAC on one and on several threads must match the streaming
+// functions fed in pieces, for messages that end on and off a block boundary
+void runtest_mac(char *name, int size)
+{
+    static uint8_t input[1000000];
+    static const size_t lens[] = {0, 1, 64, 128, 1000, 1000000};
+    struct threefish_key key;
+    struct threefish_mac ctx;
+    uint8_t tag[128], expect[128], other[128];
+    int ok = 1;
+
+    printf("%s:\t", name);
+    threefish_setkey(&key, size, key_data);
+    for(size_t i = 0; i < sizeof(input); i++)
+        input[i] = i * 13 + 5;
+
+    for(size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+    {
+        threefish_mac(&key, input, lens[l], expect, 1);
+        threefish_mac(&key, input, lens[l], tag, 3);
+        ok &= (memcmp(tag, expect, size) == 0);
+
+        threefish_mac_init(&ctx, &key);
+        for(size_t offset = 0; offset < lens[l]; offset += 777)
+            threefish_mac_update(&ctx, input + offset, (lens[l] - offset < 777) ? lens[l] - offset : 777);
+        threefish_mac_final(&ctx, tag);
+        ok &= (memcmp(tag, expect, size) == 0);
+    }
+
+    // A padded last block must not give the tag of the same bytes with the
+    // padding written out
+    uint8_t padded[128] = {0};
+    padded[size - 1] = 0x80;
+    threefish_mac(&key, padded, size - 1, expect, 1);
+    threefish_mac(&key, padded, size, other, 1);
+    ok &= (memcmp(other, expect, size) != 0);
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
+
+void runtest_aead(char *name, int size)
+{
+    static uint8_t input[1000000], cipher[1000000], output[1000000];
+    static const size_t lens[] = {0, 1, 64, 129, 1000, 1000000};
+    static const size_t adlens[] = {0, 1, 300};
+    struct threefish_key key;
+    struct threefish_aead ctx;
+    uint8_t tag[128], expect[128], ad[300];
+    int ok = 1;
+
+    printf("%s:\t", name);
+    threefish_setkey(&key, size, key_data);
+    for(size_t i = 0; i < sizeof(input); i++)
+        input[i] = i * 7 + 3;
+    for(size_t i = 0; i < sizeof(ad); i++)
+        ad[i] = i * 11 + 1;
+
+    for(size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+    {
+        size_t len = lens[l];
+
+        for(size_t a = 0; a < sizeof(adlens) / sizeof(adlens[0]); a++)
+        {
+            size_t adlen = adlens[a];
+
+            threefish_aead_encrypt(&key, 42, ad, adlen, input, cipher, len, expect, 1);
+            threefish_aead_encrypt(&key, 42, ad, adlen, input, output, len, tag, 3);
+            ok &= (memcmp(tag, expect, size) == 0 && memcmp(output, cipher, len) == 0);
+
+            // Streaming, in place, with the associated data in pieces
+            size_t step = 3 * size;
+            size_t offset = 0;
+            memcpy(output, input, len);
+            threefish_aead_init(&ctx, &key, 42);
+            for(size_t i = 0; i < adlen; i += 77)
+                threefish_aead_ad(&ctx, ad + i, (adlen - i < 77) ? adlen - i : 77);
+            for(; len - offset > step; offset += step)
+                ok &= (threefish_aead_encrypt_update(&ctx, output + offset, output + offset, step) == 0);
+            threefish_aead_encrypt_final(&ctx, output + offset, output + offset, len - offset, tag);
+            ok &= (memcmp(tag, expect, size) == 0 && memcmp(output, cipher, len) == 0);
+
+            offset = 0;
+            threefish_aead_init(&ctx, &key, 42);
+            threefish_aead_ad(&ctx, ad, adlen);
+            for(; len - offset > step; offset += step)
+                threefish_aead_decrypt_update(&ctx, output + offset, output + offset, step);
+            ok &= (threefish_aead_decrypt_final(&ctx, output + offset, output + offset, len - offset, tag) == 0);
+            ok &= (memcmp(output, input, len) == 0);
+
+            ok &= (threefish_aead_decrypt(&key, 42, ad, adlen, cipher, output, len, expect, 3) == 0);
+            ok &= (memcmp(output, input, len) == 0);
+
+            // Another nonce, changed associated data, ciphertext or tag must
+            // all fail and clear the output
+            ok &= (threefish_aead_decrypt(&key, 43, ad, adlen, cipher, output, len, expect, 1) == -1);
+            ok &= (len == 0 || output[len - 1] == 0);
+            if(adlen > 0)
+                ok &= (threefish_aead_decrypt(&key, 42, ad, adlen - 1, cipher, output, len, expect, 1) == -1);
+            if(len > 0)
+            {
+                cipher[len / 2] ^= 1;
+                ok &= (threefish_aead_decrypt(&key, 42, ad, adlen, cipher, output, len, expect, 1) == -1);
+                cipher[len / 2] ^= 1;
+            }
+            expect[size - 1] ^= 0x80;
+            ok &= (threefish_aead_decrypt(&key, 42, ad, adlen, cipher, output, len, expect, 1) == -1);
+        }
+    }
+
+    threefish_aead_init(&ctx, &key, 42);
+    ok &= (threefish_aead_encrypt_update(&ctx, input, output, size + 1) == -1);
+
+    if(ok)
+        printf("OK!\n");
+    else
+        printf("Failed!\n");
+}
 
 int main()
 {
@@ -167,5 +568,28 @@ int main()
     runtest("Threefish-512 #2", 64, input_data, key_data, tweak_data, result_512);
     runtest("Threefish-1024 #1", 128, null_data, null_data, null_data, null_1024);
     runtest("Threefish-1024 #2", 128, input_data, key_data, tweak_data, result_1024);
+    runtest_key("Threefish-256 key", 32);
+    runtest_key("Threefish-512 key", 64);
+    runtest_key("Threefish-1024 key", 128);
+    runtests_xN();
+    runtest_ctr("Threefish-256 CTR", 32);
+    runtest_ctr("Threefish-512 CTR", 64);
+    runtest_ctr("Threefish-1024 CTR", 128);
+    runtest_modes("Threefish-256 ECB/CBC", 32);
+    runtest_modes("Threefish-512 ECB/CBC", 64);
+    runtest_modes("Threefish-1024 ECB/CBC", 128);
+    runtest_sectors("Threefish-256 sectors", 32);
+    runtest_sectors("Threefish-512 sectors", 64);
+    runtest_sectors("Threefish-1024 sectors", 128);
+    runtest_rng("Threefish-512 RNG", 64);
+    runtest_rng("Threefish-1024 RNG", 128);
+    runtest_ctr_hmac("Threefish-512 CTR+HMAC", 64);
+    runtest_ctr_hmac("Threefish-1024 CTR+HMAC", 128);
+    runtest_mac("Threefish-256 MAC", 32);
+    runtest_mac("Threefish-512 MAC", 64);
+    runtest_mac("Threefish-1024 MAC", 128);
+    runtest_aead("Threefish-256 AEAD", 32);
+    runtest_aead("Threefish-512 AEAD", 64);
+    runtest_aead("Threefish-1024 AEAD", 128);
     return 0;
 }
@@ -0,0 +1,88 @@
+/* Copyright (C) 2011 by clueless <clueless@thunked.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Test helper shared by the hash tests for the multi buffer functions.
+ */
+#ifndef __NOTCRYPTO_XNTEST_H_
+#define __NOTCRYPTO_XNTEST_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+// Compare a multi buffer function against the one message version. Every
+// count goes over all the padding edge lengths, slicing the message list at
+// every offset so the edges end up in every lane, and then over mixed lengths
+// so lanes run out at different times. lenbytes is the size of the length
+// field in the padding. The counts cover the switch points between the lane
+// widths of all the hashes.
+static void runtests_xN(const char *name, size_t hashsize, size_t blocksize, size_t lenbytes,
+                        void (*hashfunction)(const uint8_t *, size_t, uint8_t*),
+                        void (*hashfunction_xN)(const uint8_t *[], const size_t [], uint8_t *[], size_t))
+{
+    static const size_t counts[] = {1, 3, 8, 9, 16, 17, 32, 40};
+    const size_t edges[] = {0, 1, blocksize - lenbytes - 1, blocksize - lenbytes, blocksize - 1, blocksize,
+                            blocksize + 1, 2 * blocksize - lenbytes - 1, 2 * blocksize - lenbytes,
+                            2 * blocksize - 1, 2 * blocksize, 2 * blocksize + 1};
+    const size_t nedges = sizeof(edges) / sizeof(edges[0]);
+    static uint8_t input[1024];
+    const uint8_t *buffers[2][40 + 12];
+    size_t lens[2][40 + 12];
+    uint8_t hashes[40][64];
+    uint8_t *hashptrs[40];
+    uint8_t hash[64];
+
+    for(size_t i = 0; i < sizeof(input); i++)
+        input[i] = i * 7 + 3;
+    for(size_t i = 0; i < 40 + nedges; i++)
+    {
+        buffers[0][i] = input + i;
+        lens[0][i]    = edges[i % nedges];
+        buffers[1][i] = input + i;
+        lens[1][i]    = (i * 97) % 300;
+    }
+    for(size_t i = 0; i < 40; i++)
+        hashptrs[i] = hashes[i];
+
+    for(size_t t = 0; t < sizeof(counts) / sizeof(counts[0]); t++)
+    {
+        int ok = 1;
+        printf("%s xN Test #%zu\t", name, t + 1);
+        for(size_t set = 0; set < 2; set++)
+        {
+            for(size_t start = 0; start < ((set == 0) ? nedges : 1); start++)
+            {
+                hashfunction_xN(buffers[set] + start, lens[set] + start, hashptrs, counts[t]);
+                for(size_t i = 0; i < counts[t]; i++)
+                {
+                    hashfunction(buffers[set][start + i], lens[set][start + i], hash);
+                    ok &= (memcmp(hash, hashes[i], hashsize) == 0);
+                }
+            }
+        }
+        if(ok)
+            printf("OK!\n");
+        else
+            printf("Failed!\n");
+    }
+}
+
+#endif
@@ -21,8 +21,8 @@
 
 /* This code was implemented fom the Skein 1.3 paper
  * (https://www.schneier.com/skein1.3.pdf). The code is written to be easy to
- * understand and read, this means that no loops are unrolled and the code makes
- * use of rotation and permutation tables.  This code is written solely to learn
+ * understand and read, every block size has its own kernel that spells out the
+ * four rounds between two subkeys.  This code is written solely to learn
  * about block ciphers and threefish specifically. This code should never be
  * used in production, or anywhere else.  To the best of my knowledge this 
  * implementation is correct but you should assume there are errors in it.
@@ -34,191 +34,1121 @@
 #include <string.h>
 
 #include "threefish.h"
+#include "cpu.h"
 
-/* rotation tables */
-static const int rot_256_1[2] = {14, 16};
-static const int rot_256_2[2] = {52, 57};
-static const int rot_256_3[2] = {23, 40};
-static const int rot_256_4[2] = { 5, 37};
-static const int rot_256_5[2] = {25, 33};
-static const int rot_256_6[2] = {46, 12};
-static const int rot_256_7[2] = {58, 22};
-static const int rot_256_8[2] = {32, 32};
-static const int *rot_256[8] = {rot_256_1, rot_256_2, rot_256_3, rot_256_4, rot_256_5, rot_256_6, rot_256_7, rot_256_8}; 
-                            
-static const int rot_512_1[4] = {46, 36, 19, 37};
-static const int rot_512_2[4] = {33, 27, 14, 42};
-static const int rot_512_3[4] = {17, 49, 36, 39};
-static const int rot_512_4[4] = {44,  9, 54, 56};
-static const int rot_512_5[4] = {39, 30, 34, 24};
-static const int rot_512_6[4] = {13, 50, 10, 17};
-static const int rot_512_7[4] = {25, 29, 39, 43};
-static const int rot_512_8[4] = { 8, 35, 56, 22};
-static const int *rot_512[8] = {rot_512_1, rot_512_2, rot_512_3, rot_512_4, rot_512_5, rot_512_6, rot_512_7, rot_512_8}; 
-
-static const int rot_1024_1[8] = {24, 13,  8, 47,  8, 17, 22, 37};
-static const int rot_1024_2[8] = {38, 19, 10, 55, 49, 18, 23, 52};
-static const int rot_1024_3[8] = {33,  4, 51, 13, 34, 41, 59, 17};
-static const int rot_1024_4[8] = { 5, 20, 48, 41, 47, 28, 16, 25};
-static const int rot_1024_5[8] = {41,  9, 37, 31, 12, 47, 44, 30};
-static const int rot_1024_6[8] = {16, 34, 56, 51,  4, 53, 42, 41};
-static const int rot_1024_7[8] = {31, 44, 47, 46, 19, 42, 44, 25};
-static const int rot_1024_8[8] = { 9, 48, 35, 52, 23, 31, 37, 20};
-static const int *rot_1024[8] = {rot_1024_1, rot_1024_2, rot_1024_3, rot_1024_4, rot_1024_5, rot_1024_6, rot_1024_7, rot_1024_8};
-
-/* Permutation tables */
-static const int permutations_256[4] = {0, 3, 2, 1};
-static const int permutations_512[8] = {2, 1, 4, 7, 6, 5, 0, 3};
-static const int permutations_1024[16] = {0, 9, 2, 13, 6, 11, 4, 15, 10, 7, 12, 3, 14, 5, 8, 1};
+/* rotation tables, rot_N[d % 8][j] is the rotation of the j-th MIX in round d */
+static const int rot_256[8][2] = {
+    {14, 16},
+    {52, 57},
+    {23, 40},
+    { 5, 37},
+    {25, 33},
+    {46, 12},
+    {58, 22},
+    {32, 32}
+};
+
+static const int rot_512[8][4] = {
+    {46, 36, 19, 37},
+    {33, 27, 14, 42},
+    {17, 49, 36, 39},
+    {44,  9, 54, 56},
+    {39, 30, 34, 24},
+    {13, 50, 10, 17},
+    {25, 29, 39, 43},
+    { 8, 35, 56, 22}
+};
+
+static const int rot_1024[8][8] = {
+    {24, 13,  8, 47,  8, 17, 22, 37},
+    {38, 19, 10, 55, 49, 18, 23, 52},
+    {33,  4, 51, 13, 34, 41, 59, 17},
+    { 5, 20, 48, 41, 47, 28, 16, 25},
+    {41,  9, 37, 31, 12, 47, 44, 30},
+    {16, 34, 56, 51,  4, 53, 42, 41},
+    {31, 44, 47, 46, 19, 42, 44, 25},
+    { 9, 48, 35, 52, 23, 31, 37, 20}
+};
+
+/* The permutation after every round is not done by moving words around, instead
+ * the next round mixes the words where the permutation would have put them.
+ * The permutations return to the identity after four rounds, so the pairs below
+ * only have to be spelled out for four rounds and the subkeys are always added
+ * to the words in order. The permutation tables from the Skein paper are:
+ *   256:  {0, 3, 2, 1}
+ *   512:  {2, 1, 4, 7, 6, 5, 0, 3}
+ *   1024: {0, 9, 2, 13, 6, 11, 4, 15, 10, 7, 12, 3, 14, 5, 8, 1}
+ */
 
 /* several building block functions for the actual algorithm */
-static void threefish_subkey(int s, int words, uint64_t *key, uint64_t *tweak, uint64_t *subkey)
+static inline uint64_t threefish_lrotate(uint64_t x, int n)
 {
-    for(int i = 0; i < words; i++)
-        subkey[i] = key[(s + i) % (words + 1)];
+    return (x << n) | (x >> (64 - n));
+}
 
-    subkey[words - 3] += tweak[s % 3];
-    subkey[words - 2] += tweak[(s + 1) % 3];
-    subkey[words - 1] += s;
+static inline uint64_t threefish_rrotate(uint64_t x, int n)
+{
+    return (x >> n) | (x << (64 - n));
 }
 
-static uint64_t threefish_lrotate(uint64_t x, int n)
+static inline void threefish_mix(uint64_t *x, int a, int b, int r)
 {
-    return (x << n) | (x >> (64 - n));
+    x[a] += x[b];
+    x[b] = threefish_lrotate(x[b], r) ^ x[a];
 }
 
-static uint64_t threefish_rrotate(uint64_t x, int n)
+static inline void threefish_unmix(uint64_t *x, int a, int b, int r)
 {
-    return (x >> n) | (x << (64 - n));
+    x[b] = threefish_rrotate(x[b] ^ x[a], r);
+    x[a] -= x[b];
+}
+
+/* The key words of every subkey only depend on the key, so threefish_setkey
+ * stores them with the subkey number already added to the last word. Only the
+ * tweak words are left to add for every block, tweak holds the three tweak
+ * words followed by the first two again so that subkey s uses tweak[s % 3] and
+ * tweak[s % 3 + 1].
+ *
+ * When the key changes for every block, as in Skein, setting up all subkeys
+ * costs about as much as the encryption. With onthefly set keys holds the
+ * extended key twice in a row instead, subkey s is then the words + 1 words
+ * starting at keys + s % (words + 1) and the subkey number is added here.
+ */
+static inline void threefish_add_subkey(int s, int words, const uint64_t *keys, int onthefly, const uint64_t *tweak, uint64_t *x)
+{
+    const uint64_t *subkey = onthefly ? keys + s % (words + 1) : keys + s * words;
+
+    for(int nw = 0; nw < words; nw++)
+        x[nw] += subkey[nw];
+    x[words - 3] += tweak[s % 3];
+    x[words - 2] += tweak[s % 3 + 1];
+    if(onthefly)
+        x[words - 1] += s;
+}
+
+static inline void threefish_sub_subkey(int s, int words, const uint64_t *subkeys, const uint64_t *tweak, uint64_t *x)
+{
+    const uint64_t *subkey = subkeys + s * words;
+
+    for(int nw = 0; nw < words; nw++)
+        x[nw] -= subkey[nw];
+    x[words - 3] -= tweak[s % 3];
+    x[words - 2] -= tweak[s % 3 + 1];
+}
+
+// Threefish-256, eight rounds per iteration with the subkeys in between
+static void threefish_256_encrypt(const struct threefish_key *key, const uint64_t *tweak, uint8_t *block)
+{
+    uint64_t x[4];
+
+    memcpy(x, block, sizeof(x));
+    for(int s = 0; s < 18; s += 2)
+    {
+        threefish_add_subkey(s, 4, key->subkeys, 0, tweak, x);
+        threefish_mix(x,  0,  1, rot_256[0][0]);
+        threefish_mix(x,  2,  3, rot_256[0][1]);
+
+        threefish_mix(x,  0,  3, rot_256[1][0]);
+        threefish_mix(x,  2,  1, rot_256[1][1]);
+
+        threefish_mix(x,  0,  1, rot_256[2][0]);
+        threefish_mix(x,  2,  3, rot_256[2][1]);
+
+        threefish_mix(x,  0,  3, rot_256[3][0]);
+        threefish_mix(x,  2,  1, rot_256[3][1]);
+
+        threefish_add_subkey(s + 1, 4, key->subkeys, 0, tweak, x);
+        threefish_mix(x,  0,  1, rot_256[4][0]);
+        threefish_mix(x,  2,  3, rot_256[4][1]);
+
+        threefish_mix(x,  0,  3, rot_256[5][0]);
+        threefish_mix(x,  2,  1, rot_256[5][1]);
+
+        threefish_mix(x,  0,  1, rot_256[6][0]);
+        threefish_mix(x,  2,  3, rot_256[6][1]);
+
+        threefish_mix(x,  0,  3, rot_256[7][0]);
+        threefish_mix(x,  2,  1, rot_256[7][1]);
+    }
+    threefish_add_subkey(18, 4, key->subkeys, 0, tweak, x);
+    memcpy(block, x, sizeof(x));
+}
+
+static void threefish_256_decrypt(const struct threefish_key *key, const uint64_t *tweak, uint8_t *block)
+{
+    uint64_t x[4];
+
+    memcpy(x, block, sizeof(x));
+    threefish_sub_subkey(18, 4, key->subkeys, tweak, x);
+    for(int s = 16; s >= 0; s -= 2)
+    {
+        threefish_unmix(x,  0,  3, rot_256[7][0]);
+        threefish_unmix(x,  2,  1, rot_256[7][1]);
+
+        threefish_unmix(x,  0,  1, rot_256[6][0]);
+        threefish_unmix(x,  2,  3, rot_256[6][1]);
+
+        threefish_unmix(x,  0,  3, rot_256[5][0]);
+        threefish_unmix(x,  2,  1, rot_256[5][1]);
+
+        threefish_unmix(x,  0,  1, rot_256[4][0]);
+        threefish_unmix(x,  2,  3, rot_256[4][1]);
+
+        threefish_sub_subkey(s + 1, 4, key->subkeys, tweak, x);
+
+        threefish_unmix(x,  0,  3, rot_256[3][0]);
+        threefish_unmix(x,  2,  1, rot_256[3][1]);
+
+        threefish_unmix(x,  0,  1, rot_256[2][0]);
+        threefish_unmix(x,  2,  3, rot_256[2][1]);
+
+        threefish_unmix(x,  0,  3, rot_256[1][0]);
+        threefish_unmix(x,  2,  1, rot_256[1][1]);
+
+        threefish_unmix(x,  0,  1, rot_256[0][0]);
+        threefish_unmix(x,  2,  3, rot_256[0][1]);
+
+        threefish_sub_subkey(s, 4, key->subkeys, tweak, x);
+    }
+    memcpy(block, x, sizeof(x));
 }
 
-static void threefish_mix(int d, int j, const int **table, uint64_t *unmixed, uint64_t *mixed)
+// Threefish-512, eight rounds per iteration with the subkeys in between, keys
+// and onthefly are as for threefish_add_subkey
+__attribute__((always_inline))
+static inline void threefish_512_encrypt_words(const uint64_t *keys, int onthefly, const uint64_t *tweak, uint64_t *x)
 {
-    mixed[0] = unmixed[0] + unmixed[1];
-    mixed[1] = threefish_lrotate(unmixed[1], table[d % 8][j]) ^ mixed[0];
+    // Fully unrolled the subkey offsets and tweak words are constants
+#pragma GCC unroll 9
+    for(int s = 0; s < 18; s += 2)
+    {
+        threefish_add_subkey(s, 8, keys, onthefly, tweak, x);
+        threefish_mix(x,  0,  1, rot_512[0][0]);
+        threefish_mix(x,  2,  3, rot_512[0][1]);
+        threefish_mix(x,  4,  5, rot_512[0][2]);
+        threefish_mix(x,  6,  7, rot_512[0][3]);
+
+        threefish_mix(x,  2,  1, rot_512[1][0]);
+        threefish_mix(x,  4,  7, rot_512[1][1]);
+        threefish_mix(x,  6,  5, rot_512[1][2]);
+        threefish_mix(x,  0,  3, rot_512[1][3]);
+
+        threefish_mix(x,  4,  1, rot_512[2][0]);
+        threefish_mix(x,  6,  3, rot_512[2][1]);
+        threefish_mix(x,  0,  5, rot_512[2][2]);
+        threefish_mix(x,  2,  7, rot_512[2][3]);
+
+        threefish_mix(x,  6,  1, rot_512[3][0]);
+        threefish_mix(x,  0,  7, rot_512[3][1]);
+        threefish_mix(x,  2,  5, rot_512[3][2]);
+        threefish_mix(x,  4,  3, rot_512[3][3]);
+
+        threefish_add_subkey(s + 1, 8, keys, onthefly, tweak, x);
+        threefish_mix(x,  0,  1, rot_512[4][0]);
+        threefish_mix(x,  2,  3, rot_512[4][1]);
+        threefish_mix(x,  4,  5, rot_512[4][2]);
+        threefish_mix(x,  6,  7, rot_512[4][3]);
+
+        threefish_mix(x,  2,  1, rot_512[5][0]);
+        threefish_mix(x,  4,  7, rot_512[5][1]);
+        threefish_mix(x,  6,  5, rot_512[5][2]);
+        threefish_mix(x,  0,  3, rot_512[5][3]);
+
+        threefish_mix(x,  4,  1, rot_512[6][0]);
+        threefish_mix(x,  6,  3, rot_512[6][1]);
+        threefish_mix(x,  0,  5, rot_512[6][2]);
+        threefish_mix(x,  2,  7, rot_512[6][3]);
+
+        threefish_mix(x,  6,  1, rot_512[7][0]);
+        threefish_mix(x,  0,  7, rot_512[7][1]);
+        threefish_mix(x,  2,  5, rot_512[7][2]);
+        threefish_mix(x,  4,  3, rot_512[7][3]);
+    }
+    threefish_add_subkey(18, 8, keys, onthefly, tweak, x);
 }
 
-static void threefish_unmix(int d, int j, const int **table, uint64_t *mixed, uint64_t *unmixed)
+static void threefish_512_encrypt(const struct threefish_key *key, const uint64_t *tweak, uint8_t *block)
 {
-    unmixed[1] = threefish_rrotate(mixed[1] ^ mixed[0], table[d % 8][j]);
-    unmixed[0] = mixed[0] - unmixed[1];
+    uint64_t x[8];
+
+    memcpy(x, block, sizeof(x));
+    threefish_512_encrypt_words(key->subkeys, 0, tweak, x);
+    memcpy(block, x, sizeof(x));
 }
 
-static void threefish_encrypt_internal(int rounds, int words, const int **rot, const int *permutations, uint64_t *key, uint64_t *tweak, uint64_t *ciphertext)
+static void threefish_512_decrypt(const struct threefish_key *key, const uint64_t *tweak, uint8_t *block)
 {
-    uint64_t subkey[words];
-    uint64_t cipheralt[words]; // Alternative buffer for ciphertext (makes permutations easier)
-    
-    // perform the encryption rounds
-    for(int nr = 0; nr < rounds; nr++)
+    uint64_t x[8];
+
+    memcpy(x, block, sizeof(x));
+    threefish_sub_subkey(18, 8, key->subkeys, tweak, x);
+    for(int s = 16; s >= 0; s -= 2)
     {
-        // Create a new subkey and add it to the state
-        if(nr % 4 == 0)
+        threefish_unmix(x,  6,  1, rot_512[7][0]);
+        threefish_unmix(x,  0,  7, rot_512[7][1]);
+        threefish_unmix(x,  2,  5, rot_512[7][2]);
+        threefish_unmix(x,  4,  3, rot_512[7][3]);
+
+        threefish_unmix(x,  4,  1, rot_512[6][0]);
+        threefish_unmix(x,  6,  3, rot_512[6][1]);
+        threefish_unmix(x,  0,  5, rot_512[6][2]);
+        threefish_unmix(x,  2,  7, rot_512[6][3]);
+
+        threefish_unmix(x,  2,  1, rot_512[5][0]);
+        threefish_unmix(x,  4,  7, rot_512[5][1]);
+        threefish_unmix(x,  6,  5, rot_512[5][2]);
+        threefish_unmix(x,  0,  3, rot_512[5][3]);
+
+        threefish_unmix(x,  0,  1, rot_512[4][0]);
+        threefish_unmix(x,  2,  3, rot_512[4][1]);
+        threefish_unmix(x,  4,  5, rot_512[4][2]);
+        threefish_unmix(x,  6,  7, rot_512[4][3]);
+
+        threefish_sub_subkey(s + 1, 8, key->subkeys, tweak, x);
+
+        threefish_unmix(x,  6,  1, rot_512[3][0]);
+        threefish_unmix(x,  0,  7, rot_512[3][1]);
+        threefish_unmix(x,  2,  5, rot_512[3][2]);
+        threefish_unmix(x,  4,  3, rot_512[3][3]);
+
+        threefish_unmix(x,  4,  1, rot_512[2][0]);
+        threefish_unmix(x,  6,  3, rot_512[2][1]);
+        threefish_unmix(x,  0,  5, rot_512[2][2]);
+        threefish_unmix(x,  2,  7, rot_512[2][3]);
+
+        threefish_unmix(x,  2,  1, rot_512[1][0]);
+        threefish_unmix(x,  4,  7, rot_512[1][1]);
+        threefish_unmix(x,  6,  5, rot_512[1][2]);
+        threefish_unmix(x,  0,  3, rot_512[1][3]);
+
+        threefish_unmix(x,  0,  1, rot_512[0][0]);
+        threefish_unmix(x,  2,  3, rot_512[0][1]);
+        threefish_unmix(x,  4,  5, rot_512[0][2]);
+        threefish_unmix(x,  6,  7, rot_512[0][3]);
+
+        threefish_sub_subkey(s, 8, key->subkeys, tweak, x);
+    }
+    memcpy(block, x, sizeof(x));
+}
+
+// Threefish-1024, eight rounds per iteration with the subkeys in between, keys
+// and onthefly are as for threefish_add_subkey
+__attribute__((always_inline))
+static inline void threefish_1024_encrypt_words(const uint64_t *keys, int onthefly, const uint64_t *tweak, uint64_t *x)
+{
+    // Fully unrolled the subkey offsets and tweak words are constants
+#pragma GCC unroll 10
+    for(int s = 0; s < 20; s += 2)
+    {
+        threefish_add_subkey(s, 16, keys, onthefly, tweak, x);
+        threefish_mix(x,  0,  1, rot_1024[0][0]);
+        threefish_mix(x,  2,  3, rot_1024[0][1]);
+        threefish_mix(x,  4,  5, rot_1024[0][2]);
+        threefish_mix(x,  6,  7, rot_1024[0][3]);
+        threefish_mix(x,  8,  9, rot_1024[0][4]);
+        threefish_mix(x, 10, 11, rot_1024[0][5]);
+        threefish_mix(x, 12, 13, rot_1024[0][6]);
+        threefish_mix(x, 14, 15, rot_1024[0][7]);
+
+        threefish_mix(x,  0,  9, rot_1024[1][0]);
+        threefish_mix(x,  2, 13, rot_1024[1][1]);
+        threefish_mix(x,  6, 11, rot_1024[1][2]);
+        threefish_mix(x,  4, 15, rot_1024[1][3]);
+        threefish_mix(x, 10,  7, rot_1024[1][4]);
+        threefish_mix(x, 12,  3, rot_1024[1][5]);
+        threefish_mix(x, 14,  5, rot_1024[1][6]);
+        threefish_mix(x,  8,  1, rot_1024[1][7]);
+
+        threefish_mix(x,  0,  7, rot_1024[2][0]);
+        threefish_mix(x,  2,  5, rot_1024[2][1]);
+        threefish_mix(x,  4,  3, rot_1024[2][2]);
+        threefish_mix(x,  6,  1, rot_1024[2][3]);
+        threefish_mix(x, 12, 15, rot_1024[2][4]);
+        threefish_mix(x, 14, 13, rot_1024[2][5]);
+        threefish_mix(x,  8, 11, rot_1024[2][6]);
+        threefish_mix(x, 10,  9, rot_1024[2][7]);
+
+        threefish_mix(x,  0, 15, rot_1024[3][0]);
+        threefish_mix(x,  2, 11, rot_1024[3][1]);
+        threefish_mix(x,  6, 13, rot_1024[3][2]);
+        threefish_mix(x,  4,  9, rot_1024[3][3]);
+        threefish_mix(x, 14,  1, rot_1024[3][4]);
+        threefish_mix(x,  8,  5, rot_1024[3][5]);
+        threefish_mix(x, 10,  3, rot_1024[3][6]);
+        threefish_mix(x, 12,  7, rot_1024[3][7]);
+
+        threefish_add_subkey(s + 1, 16, keys, onthefly, tweak, x);
+        threefish_mix(x,  0,  1, rot_1024[4][0]);
+        threefish_mix(x,  2,  3, rot_1024[4][1]);
+        threefish_mix(x,  4,  5, rot_1024[4][2]);
+        threefish_mix(x,  6,  7, rot_1024[4][3]);
+        threefish_mix(x,  8,  9, rot_1024[4][4]);
+        threefish_mix(x, 10, 11, rot_1024[4][5]);
+        threefish_mix(x, 12, 13, rot_1024[4][6]);
+        threefish_mix(x, 14, 15, rot_1024[4][7]);
+
+        threefish_mix(x,  0,  9, rot_1024[5][0]);
+        threefish_mix(x,  2, 13, rot_1024[5][1]);
+        threefish_mix(x,  6, 11, rot_1024[5][2]);
+        threefish_mix(x,  4, 15, rot_1024[5][3]);
+        threefish_mix(x, 10,  7, rot_1024[5][4]);
+        threefish_mix(x, 12,  3, rot_1024[5][5]);
+        threefish_mix(x, 14,  5, rot_1024[5][6]);
+        threefish_mix(x,  8,  1, rot_1024[5][7]);
+
+        threefish_mix(x,  0,  7, rot_1024[6][0]);
+        threefish_mix(x,  2,  5, rot_1024[6][1]);
+        threefish_mix(x,  4,  3, rot_1024[6][2]);
+        threefish_mix(x,  6,  1, rot_1024[6][3]);
+        threefish_mix(x, 12, 15, rot_1024[6][4]);
+        threefish_mix(x, 14, 13, rot_1024[6][5]);
+        threefish_mix(x,  8, 11, rot_1024[6][6]);
+        threefish_mix(x, 10,  9, rot_1024[6][7]);
+
+        threefish_mix(x,  0, 15, rot_1024[7][0]);
+        threefish_mix(x,  2, 11, rot_1024[7][1]);
+        threefish_mix(x,  6, 13, rot_1024[7][2]);
+        threefish_mix(x,  4,  9, rot_1024[7][3]);
+        threefish_mix(x, 14,  1, rot_1024[7][4]);
+        threefish_mix(x,  8,  5, rot_1024[7][5]);
+        threefish_mix(x, 10,  3, rot_1024[7][6]);
+        threefish_mix(x, 12,  7, rot_1024[7][7]);
+    }
+    threefish_add_subkey(20, 16, keys, onthefly, tweak, x);
+}
+
+static void threefish_1024_encrypt(const struct threefish_key *key, const uint64_t *tweak, uint8_t *block)
+{
+    uint64_t x[16];
+
+    memcpy(x, block, sizeof(x));
+    threefish_1024_encrypt_words(key->subkeys, 0, tweak, x);
+    memcpy(block, x, sizeof(x));
+}
+
+static void threefish_1024_decrypt(const struct threefish_key *key, const uint64_t *tweak, uint8_t *block)
+{
+    uint64_t x[16];
+
+    memcpy(x, block, sizeof(x));
+    threefish_sub_subkey(20, 16, key->subkeys, tweak, x);
+    for(int s = 18; s >= 0; s -= 2)
+    {
+        threefish_unmix(x,  0, 15, rot_1024[7][0]);
+        threefish_unmix(x,  2, 11, rot_1024[7][1]);
+        threefish_unmix(x,  6, 13, rot_1024[7][2]);
+        threefish_unmix(x,  4,  9, rot_1024[7][3]);
+        threefish_unmix(x, 14,  1, rot_1024[7][4]);
+        threefish_unmix(x,  8,  5, rot_1024[7][5]);
+        threefish_unmix(x, 10,  3, rot_1024[7][6]);
+        threefish_unmix(x, 12,  7, rot_1024[7][7]);
+
+        threefish_unmix(x,  0,  7, rot_1024[6][0]);
+        threefish_unmix(x,  2,  5, rot_1024[6][1]);
+        threefish_unmix(x,  4,  3, rot_1024[6][2]);
+        threefish_unmix(x,  6,  1, rot_1024[6][3]);
+        threefish_unmix(x, 12, 15, rot_1024[6][4]);
+        threefish_unmix(x, 14, 13, rot_1024[6][5]);
+        threefish_unmix(x,  8, 11, rot_1024[6][6]);
+        threefish_unmix(x, 10,  9, rot_1024[6][7]);
+
+        threefish_unmix(x,  0,  9, rot_1024[5][0]);
+        threefish_unmix(x,  2, 13, rot_1024[5][1]);
+        threefish_unmix(x,  6, 11, rot_1024[5][2]);
+        threefish_unmix(x,  4, 15, rot_1024[5][3]);
+        threefish_unmix(x, 10,  7, rot_1024[5][4]);
+        threefish_unmix(x, 12,  3, rot_1024[5][5]);
+        threefish_unmix(x, 14,  5, rot_1024[5][6]);
+        threefish_unmix(x,  8,  1, rot_1024[5][7]);
+
+        threefish_unmix(x,  0,  1, rot_1024[4][0]);
+        threefish_unmix(x,  2,  3, rot_1024[4][1]);
+        threefish_unmix(x,  4,  5, rot_1024[4][2]);
+        threefish_unmix(x,  6,  7, rot_1024[4][3]);
+        threefish_unmix(x,  8,  9, rot_1024[4][4]);
+        threefish_unmix(x, 10, 11, rot_1024[4][5]);
+        threefish_unmix(x, 12, 13, rot_1024[4][6]);
+        threefish_unmix(x, 14, 15, rot_1024[4][7]);
+
+        threefish_sub_subkey(s + 1, 16, key->subkeys, tweak, x);
+
+        threefish_unmix(x,  0, 15, rot_1024[3][0]);
+        threefish_unmix(x,  2, 11, rot_1024[3][1]);
+        threefish_unmix(x,  6, 13, rot_1024[3][2]);
+        threefish_unmix(x,  4,  9, rot_1024[3][3]);
+        threefish_unmix(x, 14,  1, rot_1024[3][4]);
+        threefish_unmix(x,  8,  5, rot_1024[3][5]);
+        threefish_unmix(x, 10,  3, rot_1024[3][6]);
+        threefish_unmix(x, 12,  7, rot_1024[3][7]);
+
+        threefish_unmix(x,  0,  7, rot_1024[2][0]);
+        threefish_unmix(x,  2,  5, rot_1024[2][1]);
+        threefish_unmix(x,  4,  3, rot_1024[2][2]);
+        threefish_unmix(x,  6,  1, rot_1024[2][3]);
+        threefish_unmix(x, 12, 15, rot_1024[2][4]);
+        threefish_unmix(x, 14, 13, rot_1024[2][5]);
+        threefish_unmix(x,  8, 11, rot_1024[2][6]);
+        threefish_unmix(x, 10,  9, rot_1024[2][7]);
+
+        threefish_unmix(x,  0,  9, rot_1024[1][0]);
+        threefish_unmix(x,  2, 13, rot_1024[1][1]);
+        threefish_unmix(x,  6, 11, rot_1024[1][2]);
+        threefish_unmix(x,  4, 15, rot_1024[1][3]);
+        threefish_unmix(x, 10,  7, rot_1024[1][4]);
+        threefish_unmix(x, 12,  3, rot_1024[1][5]);
+        threefish_unmix(x, 14,  5, rot_1024[1][6]);
+        threefish_unmix(x,  8,  1, rot_1024[1][7]);
+
+        threefish_unmix(x,  0,  1, rot_1024[0][0]);
+        threefish_unmix(x,  2,  3, rot_1024[0][1]);
+        threefish_unmix(x,  4,  5, rot_1024[0][2]);
+        threefish_unmix(x,  6,  7, rot_1024[0][3]);
+        threefish_unmix(x,  8,  9, rot_1024[0][4]);
+        threefish_unmix(x, 10, 11, rot_1024[0][5]);
+        threefish_unmix(x, 12, 13, rot_1024[0][6]);
+        threefish_unmix(x, 14, 15, rot_1024[0][7]);
+
+        threefish_sub_subkey(s, 16, key->subkeys, tweak, x);
+    }
+    memcpy(block, x, sizeof(x));
+}
+
+#ifdef NOTCRYPTO_X86_SIMD
+/* Threefish-1024 with the whole state in two registers, e holds the even words
+ * and o the odd words. Every MIX of a round is then one add, rotate and xor on
+ * the two registers. The permutation moves even words to even positions and
+ * odd words to odd positions, so it is a single vpermq on each register.
+ */
+static const uint64_t threefish_1024_even[8]     = {0, 2, 4, 6, 8, 10, 12, 14};
+static const uint64_t threefish_1024_odd[8]      = {1, 3, 5, 7, 9, 11, 13, 15};
+static const uint64_t threefish_1024_lo[8]       = {0, 8, 1, 9, 2, 10, 3, 11};
+static const uint64_t threefish_1024_hi[8]       = {4, 12, 5, 13, 6, 14, 7, 15};
+static const uint64_t threefish_1024_perm_e[8]   = {0, 1, 3, 2, 5, 6, 7, 4};
+static const uint64_t threefish_1024_perm_o[8]   = {4, 6, 5, 7, 3, 1, 2, 0};
+static const uint64_t threefish_1024_unperm_e[8] = {0, 1, 3, 2, 7, 4, 5, 6};
+static const uint64_t threefish_1024_unperm_o[8] = {7, 5, 6, 4, 0, 2, 1, 3};
+
+// Load subkey s split in even and odd words, word 13 is odd word 6, word 14
+// is even word 7 and word 15 is odd word 7. keys and onthefly are as for
+// threefish_add_subkey.
+__attribute__((always_inline, target("avx512f")))
+static inline void threefish_1024_subkey_avx512(int s, const uint64_t *keys, int onthefly, const uint64_t *tweak,
+                                                __m512i *ke, __m512i *ko)
+{
+    const uint64_t *subkey = onthefly ? keys + s % 17 : keys + 16 * s;
+    __m512i lo = _mm512_loadu_si512(subkey);
+    __m512i hi = _mm512_loadu_si512(subkey + 8);
+
+    *ke = _mm512_permutex2var_epi64(lo, _mm512_loadu_si512(threefish_1024_even), hi);
+    *ko = _mm512_permutex2var_epi64(lo, _mm512_loadu_si512(threefish_1024_odd), hi);
+    *ko = _mm512_mask_add_epi64(*ko, 0x40, *ko, _mm512_set1_epi64(tweak[s % 3]));
+    *ke = _mm512_mask_add_epi64(*ke, 0x80, *ke, _mm512_set1_epi64(tweak[s % 3 + 1]));
+    if(onthefly)
+        *ko = _mm512_mask_add_epi64(*ko, 0x80, *ko, _mm512_set1_epi64(s));
+}
+
+// Encrypt the block at in into out, with feedforward set the plaintext is
+// xored into the result as Skein's UBI does
+__attribute__((always_inline, target("avx512f")))
+static inline void threefish_1024_encrypt_avx512_keys(const uint64_t *keys, int onthefly, const uint64_t *tweak,
+                                                      const uint8_t *in, uint8_t *out, int feedforward)
+{
+    __m512i rot[8], ke, ko;
+    __m512i perm_e = _mm512_loadu_si512(threefish_1024_perm_e);
+    __m512i perm_o = _mm512_loadu_si512(threefish_1024_perm_o);
+    __m512i lo = _mm512_loadu_si512(in);
+    __m512i hi = _mm512_loadu_si512(in + 64);
+    __m512i e = _mm512_permutex2var_epi64(lo, _mm512_loadu_si512(threefish_1024_even), hi);
+    __m512i o = _mm512_permutex2var_epi64(lo, _mm512_loadu_si512(threefish_1024_odd), hi);
+
+    for(int r = 0; r < 8; r++)
+        rot[r] = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i *)rot_1024[r]));
+
+    for(int s = 0; s < 20; s++)
+    {
+        threefish_1024_subkey_avx512(s, keys, onthefly, tweak, &ke, &ko);
+        e = _mm512_add_epi64(e, ke);
+        o = _mm512_add_epi64(o, ko);
+        for(int r = 0; r < 4; r++)
         {
-            threefish_subkey(nr / 4, words, key, tweak, subkey);
-            for(int nw = 0; nw < words; nw++)
-                ciphertext[nw] += subkey[nw];
+            e = _mm512_add_epi64(e, o);
+            o = _mm512_xor_si512(_mm512_rolv_epi64(o, rot[(s % 2) * 4 + r]), e);
+            e = _mm512_permutexvar_epi64(perm_e, e);
+            o = _mm512_permutexvar_epi64(perm_o, o);
         }
-        
-        // Mix the encryption state into the alternate buffer
-        for(int nw = 0; nw < words; nw += 2)
-            threefish_mix(nr, nw / 2, rot, &ciphertext[nw], &cipheralt[nw]);
+    }
+    threefish_1024_subkey_avx512(20, keys, onthefly, tweak, &ke, &ko);
+    e = _mm512_add_epi64(e, ke);
+    o = _mm512_add_epi64(o, ko);
 
-        // Permutate the encrytion state from the alternate buffer into the ciphertext buffer
-        for(int nw = 0; nw < words; nw++)
-            ciphertext[nw] = cipheralt[permutations[nw]];
+    __m512i outlo = _mm512_permutex2var_epi64(e, _mm512_loadu_si512(threefish_1024_lo), o);
+    __m512i outhi = _mm512_permutex2var_epi64(e, _mm512_loadu_si512(threefish_1024_hi), o);
+    if(feedforward)
+    {
+        outlo = _mm512_xor_si512(outlo, lo);
+        outhi = _mm512_xor_si512(outhi, hi);
     }
-    // Add the last subkey
-    threefish_subkey(rounds / 4, words, key, tweak, subkey);
-    for(int nw = 0; nw < words; nw++)
-        ciphertext[nw] += subkey[nw];
+    _mm512_storeu_si512(out, outlo);
+    _mm512_storeu_si512(out + 64, outhi);
 }
 
-static void threefish_decrypt_internal(int rounds, int words, const int **rot, const int *permutations, uint64_t *key, uint64_t *tweak, uint64_t *ciphertext)
+__attribute__((target("avx512f")))
+static void threefish_1024_encrypt_avx512(const struct threefish_key *key, const uint64_t *tweak, uint8_t *block)
 {
-    uint64_t subkey[words];
-    uint64_t cipheralt[words]; // Alternative buffer for ciphertext (makes permutations easier)
-    
-    // subtract the last subkey
-    threefish_subkey(rounds / 4, words, key, tweak, subkey);
-    for(int nw = 0; nw < words; nw++)
-        ciphertext[nw] -= subkey[nw];
-    
-    // perform the decryption rounds
-    for(int nr = rounds - 1; nr >= 0; nr--)
-    {
-        // Reverse permutate the encrytion state into the alternate buffer
-        for(int nw = 0; nw < words; nw++)
-            cipheralt[permutations[nw]] = ciphertext[nw];
-        
-        // Unmix the encrytion state from the alt buffer into the ciphertext buffer
-        for(int nw = 0; nw < words; nw += 2)
-            threefish_unmix(nr, nw / 2, rot, &cipheralt[nw], &ciphertext[nw]);
-        
-        // Create a new subkey and subtract it from the state
-        if(nr % 4 == 0)
+    threefish_1024_encrypt_avx512_keys(key->subkeys, 0, tweak, block, block, 0);
+}
+
+__attribute__((target("avx512f")))
+static void threefish_1024_ubi_avx512(const uint64_t *keys, const uint64_t *tweak, const uint8_t *block, uint64_t *state)
+{
+    threefish_1024_encrypt_avx512_keys(keys, 1, tweak, block, (uint8_t *)state, 1);
+}
+
+__attribute__((target("avx512f")))
+static void threefish_1024_decrypt_avx512(const struct threefish_key *key, const uint64_t *tweak, uint8_t *block)
+{
+    __m512i rot[8], ke, ko;
+    __m512i unperm_e = _mm512_loadu_si512(threefish_1024_unperm_e);
+    __m512i unperm_o = _mm512_loadu_si512(threefish_1024_unperm_o);
+    __m512i lo = _mm512_loadu_si512(block);
+    __m512i hi = _mm512_loadu_si512(block + 64);
+    __m512i e = _mm512_permutex2var_epi64(lo, _mm512_loadu_si512(threefish_1024_even), hi);
+    __m512i o = _mm512_permutex2var_epi64(lo, _mm512_loadu_si512(threefish_1024_odd), hi);
+
+    for(int r = 0; r < 8; r++)
+        rot[r] = _mm512_cvtepi32_epi64(_mm256_loadu_si256((const __m256i *)rot_1024[r]));
+
+    threefish_1024_subkey_avx512(20, key->subkeys, 0, tweak, &ke, &ko);
+    e = _mm512_sub_epi64(e, ke);
+    o = _mm512_sub_epi64(o, ko);
+    for(int s = 19; s >= 0; s--)
+    {
+        for(int r = 3; r >= 0; r--)
         {
-            threefish_subkey(nr / 4, words, key, tweak, subkey);
-            for(int nw = 0; nw < words; nw++)
-                ciphertext[nw] -= subkey[nw];
+            e = _mm512_permutexvar_epi64(unperm_e, e);
+            o = _mm512_permutexvar_epi64(unperm_o, o);
+            o = _mm512_rorv_epi64(_mm512_xor_si512(o, e), rot[(s % 2) * 4 + r]);
+            e = _mm512_sub_epi64(e, o);
         }
+        threefish_1024_subkey_avx512(s, key->subkeys, 0, tweak, &ke, &ko);
+        e = _mm512_sub_epi64(e, ke);
+        o = _mm512_sub_epi64(o, ko);
     }
+
+    _mm512_storeu_si512(block, _mm512_permutex2var_epi64(e, _mm512_loadu_si512(threefish_1024_lo), o));
+    _mm512_storeu_si512(block + 64, _mm512_permutex2var_epi64(e, _mm512_loadu_si512(threefish_1024_hi), o));
 }
+#endif
 
+// Expand the 128 bit tweak into the five words used by threefish_add_subkey
+static void threefish_tweak(const uint8_t *intweak, uint64_t *tweak)
+{
+    memcpy(tweak, intweak, 2 * sizeof(uint64_t));
+    tweak[2] = tweak[0] ^ tweak[1];
+    tweak[3] = tweak[0];
+    tweak[4] = tweak[1];
+}
 
-int threefish(int op, size_t blocksize, const uint8_t *inkey, const uint8_t *intweak, uint8_t *plaintext)
+int threefish_setkey(struct threefish_key *key, size_t blocksize, const uint8_t *inkey)
 {
-    int rounds;                 // # of rounds we need
-    int words;                  // # of 64 bit words in the plaintext/ciphertext/key
-    const int **rot;            // Pointer to the rotation tables (size depends on # words)
-    const int *permutations;    // Pointer to the permutation table (size depends on # words again)
-    
     // Set the correct parameters based on blocksize
     switch(blocksize)
     {
         case 32:
-            rounds = 72;
-            words = 4;
-            rot = rot_256;
-            permutations = permutations_256;
+            key->rounds = 72;
+            key->words = 4;
             break;
         case 64:
-            rounds = 72;
-            words = 8;
-            rot = rot_512;
-            permutations = permutations_512;
+            key->rounds = 72;
+            key->words = 8;
             break;
         case 128:
-            rounds = 80;
-            words = 16;
-            rot = rot_1024;
-            permutations = permutations_1024;
+            key->rounds = 80;
+            key->words = 16;
             break;
         default:
             return -1;
             break;
     }
-    
-    // Copy the key and tweak into local buffers we can write to, and cast the plaintext 64 bit words
-    uint64_t key[words + 1];
-    uint64_t *ciphertext = (uint64_t *)plaintext;
-    uint64_t tweak[3];
-    memcpy(key, inkey, words * sizeof(uint64_t));
-    memcpy(tweak, intweak, 2 * sizeof(uint64_t));
-    
-    // Create the third tweak word
-    tweak[2] = tweak[0] ^ tweak[1];
-    
-    // And create the extra key word
-    key[words] = 0x1BD11BDAA9FC1A22U;
+
+    // Copy the key into a local buffer and create the extra key word
+    int words = key->words;
+    uint64_t extkey[17];
+    memcpy(extkey, inkey, words * sizeof(uint64_t));
+    extkey[words] = 0x1BD11BDAA9FC1A22U;
+    for(int i = 0; i < words; i++)
+        extkey[words] ^= extkey[i];
+
+    // Every subkey is a rotation of the extended key, walk through it once
+    // instead of taking the index modulo words + 1 for every word
+    for(int s = 0; s <= key->rounds / 4; s++)
+    {
+        uint64_t *subkey = key->subkeys + s * words;
+        int k = s % (words + 1);
+
+        for(int i = 0; i < words; i++)
+        {
+            subkey[i] = extkey[k];
+            if(++k == words + 1)
+                k = 0;
+        }
+        subkey[words - 1] += s;
+    }
+
+    return 0;
+}
+
+void threefish_encrypt_block(const struct threefish_key *key, const uint8_t *intweak, uint8_t *plaintext)
+{
+    uint64_t tweak[5];
+
+    threefish_tweak(intweak, tweak);
+    switch(key->words)
+    {
+        case 4:
+            threefish_256_encrypt(key, tweak, plaintext);
+            break;
+        case 8:
+            threefish_512_encrypt(key, tweak, plaintext);
+            break;
+        case 16:
+#ifdef NOTCRYPTO_X86_SIMD
+            if(cpu_has_avx512())
+            {
+                threefish_1024_encrypt_avx512(key, tweak, plaintext);
+                break;
+            }
+#endif
+            threefish_1024_encrypt(key, tweak, plaintext);
+            break;
+    }
+}
+
+void threefish_decrypt_block(const struct threefish_key *key, const uint8_t *intweak, uint8_t *ciphertext)
+{
+    uint64_t tweak[5];
+
+    threefish_tweak(intweak, tweak);
+    switch(key->words)
+    {
+        case 4:
+            threefish_256_decrypt(key, tweak, ciphertext);
+            break;
+        case 8:
+            threefish_512_decrypt(key, tweak, ciphertext);
+            break;
+        case 16:
+#ifdef NOTCRYPTO_X86_SIMD
+            if(cpu_has_avx512())
+            {
+                threefish_1024_decrypt_avx512(key, tweak, ciphertext);
+                break;
+            }
+#endif
+            threefish_1024_decrypt(key, tweak, ciphertext);
+            break;
+    }
+}
+
+int threefish(int op, size_t blocksize, const uint8_t *inkey, const uint8_t *intweak, uint8_t *plaintext)
+{
+    struct threefish_key key;
+
+    if(threefish_setkey(&key, blocksize, inkey) != 0)
+        return -1;
+
+    if(op == THREEFISH_ENCRYPT)
+        threefish_encrypt_block(&key, intweak, plaintext);
+    else
+        threefish_decrypt_block(&key, intweak, plaintext);
+
+    return 0;
+}
+
+// Set up the extended key twice in a row from state, see threefish_add_subkey
+__attribute__((always_inline))
+static inline void threefish_ubi_keys(int words, const uint64_t *state, uint64_t *keys)
+{
+    keys[words] = 0x1BD11BDAA9FC1A22U;
+    for(int i = 0; i < words; i++)
+    {
+        keys[i] = state[i];
+        keys[words] ^= state[i];
+    }
+    for(int i = 0; i <= words; i++)
+        keys[words + 1 + i] = keys[i];
+}
+
+// Xor the message block into the cipher text to get the next chaining value
+__attribute__((always_inline))
+static inline void threefish_ubi_feedforward(int words, const uint64_t *x, const uint8_t *block, uint64_t *state)
+{
     for(int i = 0; i < words; i++)
-        key[words] ^= key[i];
-    
-    //Pass everything on into the actual encryption/decryption function
+    {
+        uint64_t m;
+        memcpy(&m, block + i * sizeof(uint64_t), sizeof(m));
+        state[i] = x[i] ^ m;
+    }
+}
+
+static void threefish_512_ubi(uint64_t *state, const uint8_t *block, const uint64_t *tweak)
+{
+    uint64_t keys[18];
+    uint64_t x[8];
+
+    threefish_ubi_keys(8, state, keys);
+    memcpy(x, block, sizeof(x));
+    threefish_512_encrypt_words(keys, 1, tweak, x);
+    threefish_ubi_feedforward(8, x, block, state);
+}
+
+static void threefish_1024_ubi(uint64_t *state, const uint8_t *block, const uint64_t *tweak)
+{
+    uint64_t keys[34];
+    uint64_t x[16];
+
+    threefish_ubi_keys(16, state, keys);
+#ifdef NOTCRYPTO_X86_SIMD
+    if(cpu_has_avx512())
+    {
+        threefish_1024_ubi_avx512(keys, tweak, block, state);
+        return;
+    }
+#endif
+    memcpy(x, block, sizeof(x));
+    threefish_1024_encrypt_words(keys, 1, tweak, x);
+    threefish_ubi_feedforward(16, x, block, state);
+}
+
+void threefish_ubi(size_t blocksize, uint64_t *state, const uint8_t *block, const uint8_t *intweak)
+{
+    uint64_t tweak[5];
+
+    threefish_tweak(intweak, tweak);
+    switch(blocksize)
+    {
+        case 64:
+            threefish_512_ubi(state, block, tweak);
+            break;
+        case 128:
+            threefish_1024_ubi(state, block, tweak);
+            break;
+    }
+}
+
+#ifdef NOTCRYPTO_X86_SIMD
+/* Multi block Threefish-512. Every 64 bit lane of a vector holds the same word
+ * of a different block, so MIX is one add, rotate and xor for 4 (AVX2) or 8
+ * (AVX-512) blocks at the same time. The lane functions take the state, the
+ * subkeys and the tweak words as state[word * width + lane].
+ */
+__attribute__((always_inline, target("avx2")))
+static inline void threefish_mix_avx2(__m256i *x, int a, int b, int r)
+{
+    x[a] = _mm256_add_epi64(x[a], x[b]);
+    x[b] = _mm256_xor_si256(_mm256_or_si256(_mm256_slli_epi64(x[b], r), _mm256_srli_epi64(x[b], 64 - r)), x[a]);
+}
+
+__attribute__((always_inline, target("avx2")))
+static inline void threefish_unmix_avx2(__m256i *x, int a, int b, int r)
+{
+    __m256i t = _mm256_xor_si256(x[b], x[a]);
+    x[b] = _mm256_or_si256(_mm256_srli_epi64(t, r), _mm256_slli_epi64(t, 64 - r));
+    x[a] = _mm256_sub_epi64(x[a], x[b]);
+}
+
+// Four rounds of Threefish-512 with the rotations rot[0] to rot[3]
+__attribute__((always_inline, target("avx2")))
+static inline void threefish_512_rounds_avx2(__m256i *x, const int (*rot)[4])
+{
+    threefish_mix_avx2(x, 0, 1, rot[0][0]);
+    threefish_mix_avx2(x, 2, 3, rot[0][1]);
+    threefish_mix_avx2(x, 4, 5, rot[0][2]);
+    threefish_mix_avx2(x, 6, 7, rot[0][3]);
+
+    threefish_mix_avx2(x, 2, 1, rot[1][0]);
+    threefish_mix_avx2(x, 4, 7, rot[1][1]);
+    threefish_mix_avx2(x, 6, 5, rot[1][2]);
+    threefish_mix_avx2(x, 0, 3, rot[1][3]);
+
+    threefish_mix_avx2(x, 4, 1, rot[2][0]);
+    threefish_mix_avx2(x, 6, 3, rot[2][1]);
+    threefish_mix_avx2(x, 0, 5, rot[2][2]);
+    threefish_mix_avx2(x, 2, 7, rot[2][3]);
+
+    threefish_mix_avx2(x, 6, 1, rot[3][0]);
+    threefish_mix_avx2(x, 0, 7, rot[3][1]);
+    threefish_mix_avx2(x, 2, 5, rot[3][2]);
+    threefish_mix_avx2(x, 4, 3, rot[3][3]);
+}
+
+__attribute__((always_inline, target("avx2")))
+static inline void threefish_512_unrounds_avx2(__m256i *x, const int (*rot)[4])
+{
+    threefish_unmix_avx2(x, 6, 1, rot[3][0]);
+    threefish_unmix_avx2(x, 0, 7, rot[3][1]);
+    threefish_unmix_avx2(x, 2, 5, rot[3][2]);
+    threefish_unmix_avx2(x, 4, 3, rot[3][3]);
+
+    threefish_unmix_avx2(x, 4, 1, rot[2][0]);
+    threefish_unmix_avx2(x, 6, 3, rot[2][1]);
+    threefish_unmix_avx2(x, 0, 5, rot[2][2]);
+    threefish_unmix_avx2(x, 2, 7, rot[2][3]);
+
+    threefish_unmix_avx2(x, 2, 1, rot[1][0]);
+    threefish_unmix_avx2(x, 4, 7, rot[1][1]);
+    threefish_unmix_avx2(x, 6, 5, rot[1][2]);
+    threefish_unmix_avx2(x, 0, 3, rot[1][3]);
+
+    threefish_unmix_avx2(x, 0, 1, rot[0][0]);
+    threefish_unmix_avx2(x, 2, 3, rot[0][1]);
+    threefish_unmix_avx2(x, 4, 5, rot[0][2]);
+    threefish_unmix_avx2(x, 6, 7, rot[0][3]);
+}
+
+// Add (sign 1) or subtract (sign -1) subkey s
+__attribute__((always_inline, target("avx2")))
+static inline void threefish_512_subkey_avx2(int s, int sign, const uint64_t *subkeys, const __m256i *tweak, __m256i *x)
+{
+    __m256i k[8];
+
+    for(int i = 0; i < 8; i++)
+        k[i] = _mm256_loadu_si256((const __m256i *)(subkeys + 4 * (8 * s + i)));
+    k[5] = _mm256_add_epi64(k[5], tweak[s % 3]);
+    k[6] = _mm256_add_epi64(k[6], tweak[s % 3 + 1]);
+    for(int i = 0; i < 8; i++)
+        x[i] = (sign > 0) ? _mm256_add_epi64(x[i], k[i]) : _mm256_sub_epi64(x[i], k[i]);
+}
+
+__attribute__((target("avx2")))
+static void threefish_512_lanes_avx2(int op, uint64_t *state, const uint64_t *subkeys, const uint64_t *intweak)
+{
+    __m256i x[8], tweak[5];
+
+    for(int i = 0; i < 8; i++)
+        x[i] = _mm256_loadu_si256((const __m256i *)(state + 4 * i));
+    for(int i = 0; i < 5; i++)
+        tweak[i] = _mm256_loadu_si256((const __m256i *)(intweak + 4 * (i % 3)));
+
     if(op == THREEFISH_ENCRYPT)
-        threefish_encrypt_internal(rounds, words, rot, permutations, key, tweak, ciphertext);
+    {
+        for(int s = 0; s < 18; s += 2)
+        {
+            threefish_512_subkey_avx2(s, 1, subkeys, tweak, x);
+            threefish_512_rounds_avx2(x, rot_512);
+            threefish_512_subkey_avx2(s + 1, 1, subkeys, tweak, x);
+            threefish_512_rounds_avx2(x, rot_512 + 4);
+        }
+        threefish_512_subkey_avx2(18, 1, subkeys, tweak, x);
+    }
     else
-        threefish_decrypt_internal(rounds, words, rot, permutations, key, tweak, ciphertext);
+    {
+        threefish_512_subkey_avx2(18, -1, subkeys, tweak, x);
+        for(int s = 16; s >= 0; s -= 2)
+        {
+            threefish_512_unrounds_avx2(x, rot_512 + 4);
+            threefish_512_subkey_avx2(s + 1, -1, subkeys, tweak, x);
+            threefish_512_unrounds_avx2(x, rot_512);
+            threefish_512_subkey_avx2(s, -1, subkeys, tweak, x);
+        }
+    }
+
+    for(int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *)(state + 4 * i), x[i]);
+}
+
+// Same as the AVX2 code on 8 lanes, vprolvq/vprorvq do the rotation in one go
+__attribute__((always_inline, target("avx512f")))
+static inline void threefish_mix_avx512(__m512i *x, int a, int b, int r)
+{
+    x[a] = _mm512_add_epi64(x[a], x[b]);
+    x[b] = _mm512_xor_si512(_mm512_rolv_epi64(x[b], _mm512_set1_epi64(r)), x[a]);
+}
+
+__attribute__((always_inline, target("avx512f")))
+static inline void threefish_unmix_avx512(__m512i *x, int a, int b, int r)
+{
+    x[b] = _mm512_rorv_epi64(_mm512_xor_si512(x[b], x[a]), _mm512_set1_epi64(r));
+    x[a] = _mm512_sub_epi64(x[a], x[b]);
+}
+
+__attribute__((always_inline, target("avx512f")))
+static inline void threefish_512_rounds_avx512(__m512i *x, const int (*rot)[4])
+{
+    threefish_mix_avx512(x, 0, 1, rot[0][0]);
+    threefish_mix_avx512(x, 2, 3, rot[0][1]);
+    threefish_mix_avx512(x, 4, 5, rot[0][2]);
+    threefish_mix_avx512(x, 6, 7, rot[0][3]);
+
+    threefish_mix_avx512(x, 2, 1, rot[1][0]);
+    threefish_mix_avx512(x, 4, 7, rot[1][1]);
+    threefish_mix_avx512(x, 6, 5, rot[1][2]);
+    threefish_mix_avx512(x, 0, 3, rot[1][3]);
+
+    threefish_mix_avx512(x, 4, 1, rot[2][0]);
+    threefish_mix_avx512(x, 6, 3, rot[2][1]);
+    threefish_mix_avx512(x, 0, 5, rot[2][2]);
+    threefish_mix_avx512(x, 2, 7, rot[2][3]);
+
+    threefish_mix_avx512(x, 6, 1, rot[3][0]);
+    threefish_mix_avx512(x, 0, 7, rot[3][1]);
+    threefish_mix_avx512(x, 2, 5, rot[3][2]);
+    threefish_mix_avx512(x, 4, 3, rot[3][3]);
+}
+
+__attribute__((always_inline, target("avx512f")))
+static inline void threefish_512_unrounds_avx512(__m512i *x, const int (*rot)[4])
+{
+    threefish_unmix_avx512(x, 6, 1, rot[3][0]);
+    threefish_unmix_avx512(x, 0, 7, rot[3][1]);
+    threefish_unmix_avx512(x, 2, 5, rot[3][2]);
+    threefish_unmix_avx512(x, 4, 3, rot[3][3]);
+
+    threefish_unmix_avx512(x, 4, 1, rot[2][0]);
+    threefish_unmix_avx512(x, 6, 3, rot[2][1]);
+    threefish_unmix_avx512(x, 0, 5, rot[2][2]);
+    threefish_unmix_avx512(x, 2, 7, rot[2][3]);
+
+    threefish_unmix_avx512(x, 2, 1, rot[1][0]);
+    threefish_unmix_avx512(x, 4, 7, rot[1][1]);
+    threefish_unmix_avx512(x, 6, 5, rot[1][2]);
+    threefish_unmix_avx512(x, 0, 3, rot[1][3]);
+
+    threefish_unmix_avx512(x, 0, 1, rot[0][0]);
+    threefish_unmix_avx512(x, 2, 3, rot[0][1]);
+    threefish_unmix_avx512(x, 4, 5, rot[0][2]);
+    threefish_unmix_avx512(x, 6, 7, rot[0][3]);
+}
+
+__attribute__((always_inline, target("avx512f")))
+static inline void threefish_512_subkey_avx512(int s, int sign, const uint64_t *subkeys, const __m512i *tweak, __m512i *x)
+{
+    __m512i k[8];
+
+    for(int i = 0; i < 8; i++)
+        k[i] = _mm512_loadu_si512(subkeys + 8 * (8 * s + i));
+    k[5] = _mm512_add_epi64(k[5], tweak[s % 3]);
+    k[6] = _mm512_add_epi64(k[6], tweak[s % 3 + 1]);
+    for(int i = 0; i < 8; i++)
+        x[i] = (sign > 0) ? _mm512_add_epi64(x[i], k[i]) : _mm512_sub_epi64(x[i], k[i]);
+}
+
+__attribute__((target("avx512f")))
+static void threefish_512_lanes_avx512(int op, uint64_t *state, const uint64_t *subkeys, const uint64_t *intweak)
+{
+    __m512i x[8], tweak[5];
+
+    for(int i = 0; i < 8; i++)
+        x[i] = _mm512_loadu_si512(state + 8 * i);
+    for(int i = 0; i < 5; i++)
+        tweak[i] = _mm512_loadu_si512(intweak + 8 * (i % 3));
+
+    if(op == THREEFISH_ENCRYPT)
+    {
+        for(int s = 0; s < 18; s += 2)
+        {
+            threefish_512_subkey_avx512(s, 1, subkeys, tweak, x);
+            threefish_512_rounds_avx512(x, rot_512);
+            threefish_512_subkey_avx512(s + 1, 1, subkeys, tweak, x);
+            threefish_512_rounds_avx512(x, rot_512 + 4);
+        }
+        threefish_512_subkey_avx512(18, 1, subkeys, tweak, x);
+    }
+    else
+    {
+        threefish_512_subkey_avx512(18, -1, subkeys, tweak, x);
+        for(int s = 16; s >= 0; s -= 2)
+        {
+            threefish_512_unrounds_avx512(x, rot_512 + 4);
+            threefish_512_subkey_avx512(s + 1, -1, subkeys, tweak, x);
+            threefish_512_unrounds_avx512(x, rot_512);
+            threefish_512_subkey_avx512(s, -1, subkeys, tweak, x);
+        }
+    }
+
+    for(int i = 0; i < 8; i++)
+        _mm512_storeu_si512(state + 8 * i, x[i]);
+}
+#endif
+
+int threefish_512_xN(int op, const struct threefish_key *keys[], const uint8_t *tweaks[], uint8_t *blocks[], size_t count)
+{
+    size_t width = 0;
+    void (*lanefunc)(int, uint64_t *, const uint64_t *, const uint64_t *) = NULL;
+
+    for(size_t i = 0; i < count; i++)
+        if(keys[i]->words != 8)
+            return -1;
+
+#ifdef NOTCRYPTO_X86_SIMD
+    if(count > 4 && cpu_has_avx512())
+    {
+        width = 8;
+        lanefunc = threefish_512_lanes_avx512;
+    }
+    else if(count > 1 && cpu_has_avx2())
+    {
+        width = 4;
+        lanefunc = threefish_512_lanes_avx2;
+    }
+#endif
+
+    // One block at a time if we can't do better
+    if(lanefunc == NULL)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            if(op == THREEFISH_ENCRYPT)
+                threefish_encrypt_block(keys[i], tweaks[i], blocks[i]);
+            else
+                threefish_decrypt_block(keys[i], tweaks[i], blocks[i]);
+        }
+        return 0;
+    }
+
+    const struct threefish_key *lanekeys[8] = {NULL};
+    uint64_t subkeys[19 * 8 * 8];
+    uint64_t state[8 * 8];
+    uint64_t tweak[3 * 8];
+    uint64_t words[8];
+
+    for(size_t i = 0; i < count; i += width)
+    {
+        // Lanes past the last block rerun the last block and are thrown away
+        size_t n = (count - i < width) ? count - i : width;
+
+        for(size_t l = 0; l < width; l++)
+        {
+            size_t b = i + ((l < n) ? l : n - 1);
+
+            // The subkeys of a lane only change when its key does, so a batch
+            // under a single key only transposes its subkeys once
+            if(lanekeys[l] != keys[b])
+            {
+                lanekeys[l] = keys[b];
+                for(int k = 0; k < 19 * 8; k++)
+                    subkeys[k * width + l] = keys[b]->subkeys[k];
+            }
+
+            memcpy(words, tweaks[b], 2 * sizeof(uint64_t));
+            tweak[l]             = words[0];
+            tweak[width + l]     = words[1];
+            tweak[2 * width + l] = words[0] ^ words[1];
+
+            memcpy(words, blocks[b], sizeof(words));
+            for(int w = 0; w < 8; w++)
+                state[w * width + l] = words[w];
+        }
+
+        lanefunc(op, state, subkeys, tweak);
+
+        for(size_t l = 0; l < n; l++)
+        {
+            for(int w = 0; w < 8; w++)
+                words[w] = state[w * width + l];
+            memcpy(blocks[i + l], words, sizeof(words));
+        }
+    }
 
     return 0;
 }
@@ -0,0 +1,835 @@
+/* Copyright (C) 2011 by clueless <clueless@thunked.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Modes of operation on top of the Threefish block functions in threefish.c.
+ * This code is written solely to learn about block cipher modes.  This code
+ * should never be used in production, or anywhere else.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "threefish.h"
+#include "hmac.h"
+
+// Bytes processed at once, small enough to stay in L1
+#define THREEFISH_CHUNK 4096
+
+// Don't start a thread for less than this many bytes
+#define THREEFISH_MIN_THREAD (256 * 1024)
+
+#define THREEFISH_MAX_THREADS 64
+
+// A contiguous run of blocks handled by one thread
+struct threefish_ctr_job
+{
+    const struct threefish_key *key;
+    const uint8_t *nonce;
+    uint64_t counter;       // Counter of the first block of the run
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len;
+};
+
+// Encrypt or decrypt blocks contiguous blocks in place, at most THREEFISH_CHUNK
+// bytes. Block i uses the 16 byte tweak at tweaks + i * tweakstride, so a
+// stride of 0 uses the same tweak for every block.
+static void threefish_blocks(int op, const struct threefish_key *key, const uint8_t *tweaks, size_t tweakstride,
+                             uint8_t *buf, size_t blocks)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+
+    // Threefish-512 has a multi block version
+    if(key->words == 8)
+    {
+        const struct threefish_key *keys[THREEFISH_CHUNK / 64];
+        const uint8_t *tweakptrs[THREEFISH_CHUNK / 64];
+        uint8_t *blockptrs[THREEFISH_CHUNK / 64];
+
+        for(size_t i = 0; i < blocks; i++)
+        {
+            keys[i] = key;
+            tweakptrs[i] = tweaks + i * tweakstride;
+            blockptrs[i] = buf + i * blocksize;
+        }
+        threefish_512_xN(op, keys, tweakptrs, blockptrs, blocks);
+        return;
+    }
+
+    for(size_t i = 0; i < blocks; i++)
+    {
+        if(op == THREEFISH_ENCRYPT)
+            threefish_encrypt_block(key, tweaks + i * tweakstride, buf + i * blocksize);
+        else
+            threefish_decrypt_block(key, tweaks + i * tweakstride, buf + i * blocksize);
+    }
+}
+
+// Encrypt the nonce with the counters counter to counter + blocks - 1 as tweak
+static void threefish_ctr_keystream(const struct threefish_key *key, const uint8_t *nonce, uint64_t counter, uint8_t *stream, size_t blocks)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    uint8_t tweaks[THREEFISH_CHUNK / 32][16];
+
+    for(size_t i = 0; i < blocks; i++)
+    {
+        uint64_t tweak[2] = {counter + i, 0};
+
+        memcpy(tweaks[i], tweak, sizeof(tweak));
+        memcpy(stream + i * blocksize, nonce, blocksize);
+    }
+    threefish_blocks(THREEFISH_ENCRYPT, key, tweaks[0], 16, stream, blocks);
+}
+
+// Counter mode on at most THREEFISH_CHUNK bytes starting at block counter
+static void threefish_ctr_chunk(const struct threefish_key *key, const uint8_t *nonce, uint64_t counter,
+                                const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    uint8_t stream[THREEFISH_CHUNK];
+
+    threefish_ctr_keystream(key, nonce, counter, stream, (len + blocksize - 1) / blocksize);
+    for(size_t i = 0; i < len; i++)
+        out[i] = in[i] ^ stream[i];
+}
+
+static void threefish_ctr_run(const struct threefish_ctr_job *job)
+{
+    size_t blocksize = job->key->words * sizeof(uint64_t);
+
+    for(size_t offset = 0; offset < job->len; offset += THREEFISH_CHUNK)
+    {
+        size_t len = job->len - offset;
+        if(len > THREEFISH_CHUNK)
+            len = THREEFISH_CHUNK;
+
+        threefish_ctr_chunk(job->key, job->nonce, job->counter + offset / blocksize,
+                            job->in + offset, job->out + offset, len);
+    }
+}
+
+static void *threefish_ctr_thread(void *arg)
+{
+    threefish_ctr_run(arg);
+    return NULL;
+}
+
+// Number of threads to use for len bytes, every thread gets at least
+// THREEFISH_MIN_THREAD bytes
+static int threefish_threads(int threads, size_t len)
+{
+    if(threads > THREEFISH_MAX_THREADS)
+        threads = THREEFISH_MAX_THREADS;
+    if((size_t)threads > len / THREEFISH_MIN_THREAD)
+        threads = len / THREEFISH_MIN_THREAD;
+    if(threads < 1)
+        threads = 1;
+    return threads;
+}
+
+// Run count jobs of jobsize bytes each on their own thread, the first job runs
+// on this thread as does any job whose thread didn't start
+static void threefish_parallel(void *(*thread)(void *), void *jobs, size_t jobsize, int count)
+{
+    pthread_t tids[THREEFISH_MAX_THREADS];
+    int started[THREEFISH_MAX_THREADS];
+
+    for(int t = 1; t < count; t++)
+        started[t] = (pthread_create(&tids[t], NULL, thread, (uint8_t *)jobs + t * jobsize) == 0);
+    thread(jobs);
+    for(int t = 1; t < count; t++)
+    {
+        if(started[t])
+            pthread_join(tids[t], NULL);
+        else
+            thread((uint8_t *)jobs + t * jobsize);
+    }
+}
+
+void threefish_ctr(const struct threefish_key *key, const uint8_t *nonce, uint64_t counter,
+                   const uint8_t *in, uint8_t *out, size_t len, int threads)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    size_t blocks = (len + blocksize - 1) / blocksize;
+    struct threefish_ctr_job jobs[THREEFISH_MAX_THREADS];
+
+    threads = threefish_threads(threads, len);
+
+    // Split the blocks in one contiguous run per thread, the key stream only
+    // depends on the block number so the output doesn't depend on the split
+    size_t perthread = (blocks + threads - 1) / threads;
+    for(int t = 0; t < threads; t++)
+    {
+        size_t first = t * perthread * blocksize;
+        size_t end = first + perthread * blocksize;
+
+        if(first > len)
+            first = len;
+        if(end > len)
+            end = len;
+        jobs[t].key     = key;
+        jobs[t].nonce   = nonce;
+        jobs[t].counter = counter + t * perthread;
+        jobs[t].in      = in + first;
+        jobs[t].out     = out + first;
+        jobs[t].len     = end - first;
+    }
+
+    threefish_parallel(threefish_ctr_thread, jobs, sizeof(struct threefish_ctr_job), threads);
+}
+
+int threefish_ecb(int op, const struct threefish_key *key, const uint8_t *tweak,
+                  const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+
+    if(len % blocksize != 0)
+        return -1;
+
+    for(size_t offset = 0; offset < len; offset += THREEFISH_CHUNK)
+    {
+        size_t n = len - offset;
+        if(n > THREEFISH_CHUNK)
+            n = THREEFISH_CHUNK;
+
+        memmove(out + offset, in + offset, n);
+        threefish_blocks(op, key, tweak, 0, out + offset, n / blocksize);
+    }
+    return 0;
+}
+
+int threefish_cbc(int op, const struct threefish_key *key, const uint8_t *tweak, const uint8_t *iv,
+                  const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    uint8_t prev[128];
+
+    if(len % blocksize != 0)
+        return -1;
+    memcpy(prev, iv, blocksize);
+
+    // Every block depends on the one before it
+    if(op == THREEFISH_ENCRYPT)
+    {
+        for(size_t offset = 0; offset < len; offset += blocksize)
+        {
+            for(size_t i = 0; i < blocksize; i++)
+                prev[i] ^= in[offset + i];
+            threefish_encrypt_block(key, tweak, prev);
+            memcpy(out + offset, prev, blocksize);
+        }
+        return 0;
+    }
+
+    // Decryption only needs the ciphertext, so a whole chunk of blocks goes
+    // through the multi block code before the chaining is undone. The
+    // ciphertext block is read before out is written so in and out can be the
+    // same buffer.
+    uint8_t buf[THREEFISH_CHUNK];
+    uint8_t cipher[128];
+
+    for(size_t offset = 0; offset < len; offset += THREEFISH_CHUNK)
+    {
+        size_t n = len - offset;
+        if(n > THREEFISH_CHUNK)
+            n = THREEFISH_CHUNK;
+
+        memcpy(buf, in + offset, n);
+        threefish_blocks(THREEFISH_DECRYPT, key, tweak, 0, buf, n / blocksize);
+        for(size_t b = 0; b < n; b += blocksize)
+        {
+            memcpy(cipher, in + offset + b, blocksize);
+            for(size_t i = 0; i < blocksize; i++)
+                out[offset + b + i] = buf[b + i] ^ prev[i];
+            memcpy(prev, cipher, blocksize);
+        }
+    }
+    return 0;
+}
+
+int threefish_sectors(int op, const struct threefish_key *key, uint64_t sector, size_t sectorsize,
+                      const uint8_t *in, uint8_t *out, size_t count)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    size_t perchunk = THREEFISH_CHUNK / blocksize;
+    size_t blocks = sectorsize / blocksize * count;
+    uint8_t tweaks[THREEFISH_CHUNK / 32][16];
+
+    if(sectorsize == 0 || sectorsize % blocksize != 0)
+        return -1;
+
+    // Go through the run a chunk at a time, the tweak of each block follows
+    // from its position so chunks don't have to line up with sectors
+    for(size_t first = 0; first < blocks; first += perchunk)
+    {
+        size_t n = blocks - first;
+        if(n > perchunk)
+            n = perchunk;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            uint64_t tweak[2];
+
+            tweak[0] = sector + (first + i) / (sectorsize / blocksize);
+            tweak[1] = (first + i) % (sectorsize / blocksize);
+            memcpy(tweaks[i], tweak, sizeof(tweak));
+        }
+        memmove(out + first * blocksize, in + first * blocksize, n * blocksize);
+        threefish_blocks(op, key, tweaks[0], 16, out + first * blocksize, n);
+    }
+    return 0;
+}
+
+int threefish_rng_init(struct threefish_rng *rng, size_t blocksize, const uint8_t *seed)
+{
+    if(threefish_setkey(&rng->key, blocksize, seed) != 0)
+        return -1;
+    memset(rng->nonce, 0, sizeof(rng->nonce));
+    rng->counter = 0;
+    return 0;
+}
+
+void threefish_rng_seek(struct threefish_rng *rng, uint64_t block)
+{
+    rng->counter = block;
+}
+
+void threefish_rng_fill(struct threefish_rng *rng, uint8_t *out, size_t len)
+{
+    size_t blocksize = rng->key.words * sizeof(uint64_t);
+    size_t whole = len - len % blocksize;
+
+    // Whole blocks go straight into out, a chunk at a time
+    for(size_t offset = 0; offset < whole; offset += THREEFISH_CHUNK)
+    {
+        size_t n = whole - offset;
+        if(n > THREEFISH_CHUNK)
+            n = THREEFISH_CHUNK;
+
+        threefish_ctr_keystream(&rng->key, rng->nonce, rng->counter, out + offset, n / blocksize);
+        rng->counter += n / blocksize;
+    }
+
+    // The rest of the last block is thrown away
+    if(whole < len)
+    {
+        uint8_t block[128];
+
+        threefish_ctr_keystream(&rng->key, rng->nonce, rng->counter, block, 1);
+        memcpy(out + whole, block, len - whole);
+        rng->counter++;
+    }
+}
+
+/* Encrypt-then-MAC in one pass, every chunk of ciphertext goes into the HMAC
+ * right after it is written while it is still in the cache.
+ */
+
+// The nonce and the starting counter go into the HMAC ahead of the ciphertext,
+// the counter as 8 little endian bytes
+static void threefish_ctr_hmac_header(struct hmac_context *ctx, const uint8_t *nonce, size_t blocksize, uint64_t counter)
+{
+    uint8_t bytes[8];
+
+    for(int i = 0; i < 8; i++)
+        bytes[i] = (uint8_t)(counter >> (8 * i));
+    hmac_update(ctx, nonce, blocksize);
+    hmac_update(ctx, bytes, sizeof(bytes));
+}
+
+int threefish_ctr_hmac_encrypt(const struct threefish_key *key, const uint8_t *nonce, uint64_t counter,
+                               const uint8_t *mackey, size_t mackeylen, int hashtype,
+                               const uint8_t *in, uint8_t *out, size_t len, uint8_t *mac)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    struct hmac_context ctx;
+
+    if(hmac_init(&ctx, mackey, mackeylen, hashtype) != 0)
+        return -1;
+    threefish_ctr_hmac_header(&ctx, nonce, blocksize, counter);
+    for(size_t offset = 0; offset < len; offset += THREEFISH_CHUNK)
+    {
+        size_t n = len - offset;
+        if(n > THREEFISH_CHUNK)
+            n = THREEFISH_CHUNK;
+
+        threefish_ctr_chunk(key, nonce, counter + offset / blocksize, in + offset, out + offset, n);
+        hmac_update(&ctx, out + offset, n);
+    }
+    hmac_final(&ctx, mac);
+    return 0;
+}
+
+int threefish_ctr_hmac_decrypt(const struct threefish_key *key, const uint8_t *nonce, uint64_t counter,
+                               const uint8_t *mackey, size_t mackeylen, int hashtype,
+                               const uint8_t *in, uint8_t *out, size_t len, const uint8_t *mac)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    struct hmac_context ctx;
+    uint8_t expect[128];
+    uint8_t diff = 0;
+
+    // The ciphertext goes into the HMAC before the chunk is decrypted, so in
+    // and out can be the same buffer
+    if(hmac_init(&ctx, mackey, mackeylen, hashtype) != 0)
+        return -1;
+    threefish_ctr_hmac_header(&ctx, nonce, blocksize, counter);
+    for(size_t offset = 0; offset < len; offset += THREEFISH_CHUNK)
+    {
+        size_t n = len - offset;
+        if(n > THREEFISH_CHUNK)
+            n = THREEFISH_CHUNK;
+
+        hmac_update(&ctx, in + offset, n);
+        threefish_ctr_chunk(key, nonce, counter + offset / blocksize, in + offset, out + offset, n);
+    }
+    hmac_final(&ctx, expect);
+
+    // Look at every byte of the MAC, and don't leave unauthenticated
+    // plaintext behind
+    for(size_t i = 0; i < ctx.hashsize; i++)
+        diff |= expect[i] ^ mac[i];
+    if(diff != 0)
+    {
+        memset(out, 0, len);
+        return -1;
+    }
+    return 0;
+}
+
+/* Parallel MAC. Every block but the last is encrypted on its own with its block
+ * number as tweak and the results are xored together. The last block is xored
+ * in as is, padded with 0x80 and zeroes when it isn't full, and the sum is
+ * encrypted once more with a tweak that tells a full last block from a padded
+ * one. All blocks but the last are independent so they go through the multi
+ * block code and can be split over threads.
+ */
+#define THREEFISH_MAC_BLOCK   1
+#define THREEFISH_MAC_FULL    2
+#define THREEFISH_MAC_PADDED  3
+
+// Xor the encryptions of blocks blocks starting at block number first into sum,
+// domain is added to the block number to keep other users of these functions
+// apart from the plain MAC
+static void threefish_mac_blocks(const struct threefish_key *key, uint64_t domain, uint64_t first,
+                                 const uint8_t *in, size_t blocks, uint8_t *sum)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    size_t perchunk = THREEFISH_CHUNK / blocksize;
+    uint8_t buf[THREEFISH_CHUNK];
+    uint8_t tweaks[THREEFISH_CHUNK / 32][16];
+
+    for(size_t done = 0; done < blocks; done += perchunk)
+    {
+        size_t n = blocks - done;
+        if(n > perchunk)
+            n = perchunk;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            uint64_t tweak[2] = {domain | (first + done + i), THREEFISH_MAC_BLOCK};
+            memcpy(tweaks[i], tweak, sizeof(tweak));
+        }
+        memcpy(buf, in + done * blocksize, n * blocksize);
+        threefish_blocks(THREEFISH_ENCRYPT, key, tweaks[0], 16, buf, n);
+        for(size_t i = 0; i < n * blocksize; i++)
+            sum[i % blocksize] ^= buf[i];
+    }
+}
+
+// Add the last block of bytes bytes and encrypt the sum into the tag
+static void threefish_mac_last(const struct threefish_key *key, uint64_t domain, uint64_t index,
+                               const uint8_t *last, size_t bytes, uint8_t *sum, uint8_t *tag)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    uint64_t tweak[2] = {domain | index, THREEFISH_MAC_FULL};
+
+    for(size_t i = 0; i < bytes; i++)
+        sum[i] ^= last[i];
+    if(bytes < blocksize)
+    {
+        sum[bytes] ^= 0x80;
+        tweak[1] = THREEFISH_MAC_PADDED;
+    }
+    memcpy(tag, sum, blocksize);
+    threefish_encrypt_block(key, (const uint8_t *)tweak, tag);
+}
+
+static void threefish_mac_start(struct threefish_mac *ctx, const struct threefish_key *key, uint64_t domain)
+{
+    ctx->key = key;
+    ctx->domain = domain;
+    memset(ctx->sum, 0, sizeof(ctx->sum));
+    ctx->bufused = 0;
+    ctx->blocks = 0;
+}
+
+void threefish_mac_init(struct threefish_mac *ctx, const struct threefish_key *key)
+{
+    threefish_mac_start(ctx, key, 0);
+}
+
+// The last block is handled differently, so the buffer is only emptied when
+// more data follows it
+void threefish_mac_update(struct threefish_mac *ctx, const uint8_t *buffer, size_t len)
+{
+    size_t blocksize = ctx->key->words * sizeof(uint64_t);
+
+    if(len == 0)
+        return;
+
+    if(ctx->bufused > 0 || len <= blocksize)
+    {
+        size_t cpylen = ((blocksize - ctx->bufused) <= len) ? blocksize - ctx->bufused : len;
+        memcpy(ctx->buffer + ctx->bufused, buffer, cpylen);
+        ctx->bufused += cpylen;
+        buffer += cpylen;
+        len -= cpylen;
+
+        if(len == 0)
+            return;
+        threefish_mac_blocks(ctx->key, ctx->domain, ctx->blocks, ctx->buffer, 1, ctx->sum);
+        ctx->blocks++;
+        ctx->bufused = 0;
+    }
+
+    // Whole blocks straight from the input, but keep the last one
+    size_t blocks = (len - 1) / blocksize;
+    threefish_mac_blocks(ctx->key, ctx->domain, ctx->blocks, buffer, blocks, ctx->sum);
+    ctx->blocks += blocks;
+
+    memcpy(ctx->buffer, buffer + blocks * blocksize, len - blocks * blocksize);
+    ctx->bufused = len - blocks * blocksize;
+}
+
+void threefish_mac_final(struct threefish_mac *ctx, uint8_t *tag)
+{
+    threefish_mac_last(ctx->key, ctx->domain, ctx->blocks, ctx->buffer, ctx->bufused, ctx->sum, tag);
+}
+
+// A contiguous run of blocks for one thread, sum gets the xor of its blocks
+struct threefish_mac_job
+{
+    const struct threefish_key *key;
+    uint64_t domain;
+    uint64_t first;
+    const uint8_t *in;
+    size_t blocks;
+    uint8_t sum[128];
+};
+
+static void *threefish_mac_thread(void *arg)
+{
+    struct threefish_mac_job *job = arg;
+
+    memset(job->sum, 0, sizeof(job->sum));
+    threefish_mac_blocks(job->key, job->domain, job->first, job->in, job->blocks, job->sum);
+    return NULL;
+}
+
+static void threefish_mac_run(const struct threefish_key *key, uint64_t domain, const uint8_t *in, size_t len,
+                              uint8_t *tag, int threads)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    size_t blocks = (len > 0) ? (len - 1) / blocksize : 0;
+    struct threefish_mac_job jobs[THREEFISH_MAX_THREADS];
+    uint8_t sum[128] = {0};
+
+    // Everything but the last block is split over the threads
+    threads = threefish_threads(threads, len);
+    size_t perthread = (blocks + threads - 1) / threads;
+    for(int t = 0; t < threads; t++)
+    {
+        size_t first = t * perthread;
+        size_t end = first + perthread;
+
+        if(first > blocks)
+            first = blocks;
+        if(end > blocks)
+            end = blocks;
+        jobs[t].key    = key;
+        jobs[t].domain = domain;
+        jobs[t].first  = first;
+        jobs[t].in     = in + first * blocksize;
+        jobs[t].blocks = end - first;
+    }
+    threefish_parallel(threefish_mac_thread, jobs, sizeof(struct threefish_mac_job), threads);
+
+    for(int t = 0; t < threads; t++)
+        for(size_t i = 0; i < blocksize; i++)
+            sum[i] ^= jobs[t].sum[i];
+    threefish_mac_last(key, domain, blocks, in + blocks * blocksize, len - blocks * blocksize, sum, tag);
+}
+
+void threefish_mac(const struct threefish_key *key, const uint8_t *in, size_t len, uint8_t *tag, int threads)
+{
+    threefish_mac_run(key, 0, in, len, tag, threads);
+}
+
+/* Authenticated encryption in the style of OCB, built straight on the tweak as
+ * in the Theta-CB construction. Every whole block is encrypted on its own with
+ * a tweak of its block number and role in the first word and the nonce in the
+ * second, and the plaintext blocks are xored into a checksum. The bytes after
+ * the last whole block are xored with an encrypted zero block, padded with 0x80
+ * and zeroes into the checksum, and the checksum is encrypted into the tag. The
+ * associated data goes through the parallel MAC above under its own domain and
+ * its tag is xored in. This is one cipher call per block and the whole blocks
+ * don't depend on each other, so they go through the multi block code and can
+ * be split over threads.
+ */
+#define THREEFISH_AEAD_BLOCK  1
+#define THREEFISH_AEAD_PAD    2
+#define THREEFISH_AEAD_TAG    3
+
+// The role is kept in the top byte of the first tweak word
+#define THREEFISH_AEAD_ROLE(role) ((uint64_t)(role) << 56)
+#define THREEFISH_AEAD_AD     THREEFISH_AEAD_ROLE(0x80)
+
+// Encrypt or decrypt blocks whole blocks starting at block number first and xor
+// the plaintext into checksum, in and out may be the same buffer
+static void threefish_aead_blocks(int op, const struct threefish_key *key, uint64_t nonce, uint64_t first,
+                                  const uint8_t *in, uint8_t *out, size_t blocks, uint8_t *checksum)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    size_t perchunk = THREEFISH_CHUNK / blocksize;
+    uint8_t buf[THREEFISH_CHUNK];
+    uint8_t tweaks[THREEFISH_CHUNK / 32][16];
+
+    for(size_t done = 0; done < blocks; done += perchunk)
+    {
+        size_t n = blocks - done;
+        if(n > perchunk)
+            n = perchunk;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            uint64_t tweak[2] = {THREEFISH_AEAD_ROLE(THREEFISH_AEAD_BLOCK) | (first + done + i), nonce};
+            memcpy(tweaks[i], tweak, sizeof(tweak));
+        }
+        memcpy(buf, in + done * blocksize, n * blocksize);
+        if(op == THREEFISH_ENCRYPT)
+            for(size_t i = 0; i < n * blocksize; i++)
+                checksum[i % blocksize] ^= buf[i];
+        threefish_blocks(op, key, tweaks[0], 16, buf, n);
+        if(op == THREEFISH_DECRYPT)
+            for(size_t i = 0; i < n * blocksize; i++)
+                checksum[i % blocksize] ^= buf[i];
+        memcpy(out + done * blocksize, buf, n * blocksize);
+    }
+}
+
+// Handle the bytes bytes after the last whole block, which has number index,
+// and make the tag from the checksum and the tag of the associated data
+static void threefish_aead_last(int op, const struct threefish_key *key, uint64_t nonce, uint64_t index,
+                                const uint8_t *in, uint8_t *out, size_t bytes, uint8_t *checksum,
+                                const uint8_t *adtag, uint8_t *tag)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    uint8_t pad[128] = {0};
+
+    if(bytes > 0)
+    {
+        uint64_t tweak[2] = {THREEFISH_AEAD_ROLE(THREEFISH_AEAD_PAD) | index, nonce};
+
+        threefish_encrypt_block(key, (const uint8_t *)tweak, pad);
+        for(size_t i = 0; i < bytes; i++)
+        {
+            uint8_t plain = (op == THREEFISH_ENCRYPT) ? in[i] : in[i] ^ pad[i];
+
+            out[i] = in[i] ^ pad[i];
+            checksum[i] ^= plain;
+        }
+    }
+    checksum[bytes] ^= 0x80;
+
+    uint64_t tweak[2] = {THREEFISH_AEAD_ROLE(THREEFISH_AEAD_TAG) | index, nonce};
+    memcpy(tag, checksum, blocksize);
+    threefish_encrypt_block(key, (const uint8_t *)tweak, tag);
+    for(size_t i = 0; i < blocksize; i++)
+        tag[i] ^= adtag[i];
+}
+
+void threefish_aead_init(struct threefish_aead *ctx, const struct threefish_key *key, uint64_t nonce)
+{
+    ctx->key = key;
+    ctx->nonce = nonce;
+    threefish_mac_start(&ctx->ad, key, THREEFISH_AEAD_AD);
+    ctx->hasad = 0;
+    memset(ctx->checksum, 0, sizeof(ctx->checksum));
+    ctx->blocks = 0;
+}
+
+void threefish_aead_ad(struct threefish_aead *ctx, const uint8_t *ad, size_t len)
+{
+    if(len == 0)
+        return;
+    threefish_mac_update(&ctx->ad, ad, len);
+    ctx->hasad = 1;
+}
+
+static int threefish_aead_update(int op, struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t blocksize = ctx->key->words * sizeof(uint64_t);
+
+    if(len % blocksize != 0)
+        return -1;
+    threefish_aead_blocks(op, ctx->key, ctx->nonce, ctx->blocks, in, out, len / blocksize, ctx->checksum);
+    ctx->blocks += len / blocksize;
+    return 0;
+}
+
+static void threefish_aead_final(int op, struct threefish_aead *ctx, const uint8_t *in, uint8_t *out,
+                                 size_t len, uint8_t *tag)
+{
+    size_t blocksize = ctx->key->words * sizeof(uint64_t);
+    size_t whole = len - len % blocksize;
+    uint8_t adtag[128] = {0};
+
+    threefish_aead_update(op, ctx, in, out, whole);
+    if(ctx->hasad)
+        threefish_mac_final(&ctx->ad, adtag);
+    threefish_aead_last(op, ctx->key, ctx->nonce, ctx->blocks, in + whole, out + whole, len - whole,
+                        ctx->checksum, adtag, tag);
+}
+
+int threefish_aead_encrypt_update(struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len)
+{
+    return threefish_aead_update(THREEFISH_ENCRYPT, ctx, in, out, len);
+}
+
+void threefish_aead_encrypt_final(struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len,
+                                  uint8_t *tag)
+{
+    threefish_aead_final(THREEFISH_ENCRYPT, ctx, in, out, len, tag);
+}
+
+int threefish_aead_decrypt_update(struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len)
+{
+    return threefish_aead_update(THREEFISH_DECRYPT, ctx, in, out, len);
+}
+
+int threefish_aead_decrypt_final(struct threefish_aead *ctx, const uint8_t *in, uint8_t *out, size_t len,
+                                 const uint8_t *tag)
+{
+    size_t blocksize = ctx->key->words * sizeof(uint64_t);
+    uint8_t expect[128];
+    uint8_t diff = 0;
+
+    threefish_aead_final(THREEFISH_DECRYPT, ctx, in, out, len, expect);
+    for(size_t i = 0; i < blocksize; i++)
+        diff |= expect[i] ^ tag[i];
+    if(diff != 0)
+    {
+        memset(out, 0, len);
+        return -1;
+    }
+    return 0;
+}
+
+// A contiguous run of whole blocks for one thread, checksum gets the xor of
+// its plaintext blocks
+struct threefish_aead_job
+{
+    int op;
+    const struct threefish_key *key;
+    uint64_t nonce;
+    uint64_t first;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t blocks;
+    uint8_t checksum[128];
+};
+
+static void *threefish_aead_thread(void *arg)
+{
+    struct threefish_aead_job *job = arg;
+
+    memset(job->checksum, 0, sizeof(job->checksum));
+    threefish_aead_blocks(job->op, job->key, job->nonce, job->first, job->in, job->out, job->blocks, job->checksum);
+    return NULL;
+}
+
+static void threefish_aead_run(int op, const struct threefish_key *key, uint64_t nonce,
+                               const uint8_t *ad, size_t adlen, const uint8_t *in, uint8_t *out, size_t len,
+                               uint8_t *tag, int threads)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    size_t blocks = len / blocksize;
+    struct threefish_aead_job jobs[THREEFISH_MAX_THREADS];
+    uint8_t checksum[128] = {0};
+    uint8_t adtag[128] = {0};
+
+    if(adlen > 0)
+        threefish_mac_run(key, THREEFISH_AEAD_AD, ad, adlen, adtag, threads);
+
+    threads = threefish_threads(threads, len);
+    size_t perthread = (blocks + threads - 1) / threads;
+    for(int t = 0; t < threads; t++)
+    {
+        size_t first = t * perthread;
+        size_t end = first + perthread;
+
+        if(first > blocks)
+            first = blocks;
+        if(end > blocks)
+            end = blocks;
+        jobs[t].op     = op;
+        jobs[t].key    = key;
+        jobs[t].nonce  = nonce;
+        jobs[t].first  = first;
+        jobs[t].in     = in + first * blocksize;
+        jobs[t].out    = out + first * blocksize;
+        jobs[t].blocks = end - first;
+    }
+    threefish_parallel(threefish_aead_thread, jobs, sizeof(struct threefish_aead_job), threads);
+
+    for(int t = 0; t < threads; t++)
+        for(size_t i = 0; i < blocksize; i++)
+            checksum[i] ^= jobs[t].checksum[i];
+    threefish_aead_last(op, key, nonce, blocks, in + blocks * blocksize, out + blocks * blocksize,
+                        len - blocks * blocksize, checksum, adtag, tag);
+}
+
+void threefish_aead_encrypt(const struct threefish_key *key, uint64_t nonce, const uint8_t *ad, size_t adlen,
+                            const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag, int threads)
+{
+    threefish_aead_run(THREEFISH_ENCRYPT, key, nonce, ad, adlen, in, out, len, tag, threads);
+}
+
+int threefish_aead_decrypt(const struct threefish_key *key, uint64_t nonce, const uint8_t *ad, size_t adlen,
+                           const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag, int threads)
+{
+    size_t blocksize = key->words * sizeof(uint64_t);
+    uint8_t expect[128];
+    uint8_t diff = 0;
+
+    threefish_aead_run(THREEFISH_DECRYPT, key, nonce, ad, adlen, in, out, len, expect, threads);
+    for(size_t i = 0; i < blocksize; i++)
+        diff |= expect[i] ^ tag[i];
+    if(diff != 0)
+    {
+        memset(out, 0, len);
+        return -1;
+    }
+    return 0;
+}